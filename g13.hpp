@@ -19,8 +19,27 @@ namespace G13 {
     // const size_t G13_INTERFACE = 0;
     static const size_t G13_KEY_ENDPOINT = 1;
     static const size_t G13_LCD_ENDPOINT = 2;
+    // an LCD transfer is this header, 0x03 then zeros, followed by the image
+    static const size_t G13_LCD_HEADER_SIZE = 32;
     // const size_t G13_KEY_READ_TIMEOUT = 0;
 
+    /*! framed input, see G13_Device::ProcessInput()
+     *
+     * A frame is an 8 byte header followed by its payload: the magic bytes
+     * 00 'G' '1' '3', the frame type, a reserved zero byte and the payload
+     * length as 16 bit little endian. Text commands never contain a NUL, so
+     * a frame can not be mistaken for one.
+     */
+    static const unsigned char G13_FRAME_MAGIC[] = {0, 'G', '1', '3'};
+    static const size_t G13_FRAME_HEADER_SIZE = 8;
+    static const size_t G13_FRAME_MAX_PAYLOAD = 16 * 1024;
+
+    enum G13_FrameType {
+        G13_FRAME_TEXT = 1,    // one or more command lines
+        G13_FRAME_IMAGE = 2,   // a complete LPBM image
+        G13_FRAME_REGION = 3,  // 16 bit LE offset into the LPBM image + bytes
+    };
+
     // *************************************************************************
 
     class G13_CommandException : public std::exception {
@@ -9,61 +9,92 @@
 
 // *************************************************************************
 namespace G13 {
-G13_Action::~G13_Action() = default;
-
-G13_Action_Keys::G13_Action_Keys(G13_Device &keypad,
-                                 const std::string &keys_string)
-    : G13_Action(keypad) {
-  auto keydownup = Helper::split<std::vector<std::string>>(keys_string, " ");
-  auto keys = Helper::split<std::vector<std::string>>(keydownup[0], "+");
-
-  for (auto &key : keys) {
-    auto kval = G13_Manager::Instance()->FindInputKeyValue(key);
-    if (kval == BAD_KEY_VALUE) {
-      throw G13_CommandException("create action unknown key : " + key);
+const G13_Action *G13_Action::Make(std::string_view action,
+                                   Helper::Arena &arena) {
+  if (action.empty()) {
+    throw G13_CommandException("empty action string");
+  }
+  if (action[0] == '>') {
+    auto out = std::string(action.substr(1)) + "\n";
+    return arena.New<G13_Action>(
+        G13_Action_PipeOut{arena.Copy(out), out.size()});
+  } else if (action[0] == '!') {
+    const char *cmd = arena.Copy(action.substr(1));
+    G13_Command compiled{};
+    if (!G13_Device::CompileCommand(cmd, compiled)) {
+      throw G13_CommandException("unknown command : " + std::string(cmd));
     }
-    _keys.push_back(kval);
+    if (compiled.args.action) {
+      // made here as well, so that running the command makes nothing
+      compiled.args.made = Make(compiled.args.action, arena);
+    }
+    return arena.New<G13_Action>(G13_Action_Command{cmd, compiled});
   }
 
-  if (keydownup.size()>1){
-    auto keysup = Helper::split<std::vector<std::string>>(keydownup[1], "+");
-    for (auto &key : keysup) {
-      auto kval = G13_Manager::Instance()->FindInputKeyValue(key);
-      if (kval == BAD_KEY_VALUE) {
-        throw G13_CommandException("create action unknown key : " + key);
+  // keys sent on key down, optionally followed by a space and those sent on
+  // key up, each as a + separated list
+  LINUX_KEY_VALUE keys[G13_MAX_ACTION_KEYS];
+  size_t count = 0;
+  size_t down_count = 0;
+  for (size_t i = 0; i < 2 && !action.empty(); i++) {
+    auto group = Helper::split_off(action, ' ');
+    do {
+      auto key = Helper::split_off(group, '+');
+      bool negative = !key.empty() && key[0] == '-';
+      auto kval =
+          G13_Manager::Instance()->FindInputKeyValue(key.substr(negative));
+      if (kval == BAD_KEY_VALUE || (negative && !(kval & G13_REL_FLAG))) {
+        throw G13_CommandException("create action unknown key : " +
+                                   std::string(key));
+      }
+      if (count == G13_MAX_ACTION_KEYS) {
+        throw G13_CommandException("create action too many keys");
       }
-      _keysup.push_back(kval);
+      keys[count++] = negative ? kval | G13_REL_NEGATIVE : kval;
+    } while (!group.empty());
+    if (i == 0) {
+      down_count = count;
     }
   }
 
-  std::vector<int> _keys_local;
-  std::vector<int> _keysup_local;
+  return arena.New<G13_Action>(G13_Action_Keys{
+      arena.Copy(keys, count), static_cast<unsigned short>(down_count),
+      static_cast<unsigned short>(count - down_count)});
 }
 
-G13_Action_Keys::~G13_Action_Keys() = default;
+static void SendKey(G13_Device &g13, LINUX_KEY_VALUE key, bool is_down) {
+  if (!(key & G13_REL_FLAG)) {
+    g13.SendEvent(EV_KEY, key, is_down);
+  } else if (is_down) {
+    // a relative axis has nothing to release
+    g13.SendEvent(EV_REL, key & ~(G13_REL_FLAG | G13_REL_NEGATIVE),
+                  key & G13_REL_NEGATIVE ? -1 : 1);
+  }
+}
 
-void G13_Action_Keys::act(G13_Device &g13, bool is_down) {
+void G13_Action_Keys::act(G13_Device &g13, bool is_down) const {
+  const LINUX_KEY_VALUE *up_keys = keys + down_count;
   if (is_down) {
-    for (int &_key : _keys) {
-      g13.SendEvent(EV_KEY, _key, is_down);
-      G13_LOG(log4cpp::Priority::DEBUG << "sending KEY DOWN " << _key);
+    for (int i = 0; i < down_count; i++) {
+      SendKey(g13, keys[i], is_down);
+      G13_DBG("sending KEY DOWN " << keys[i]);
     }
-    if (!_keysup.empty()) for (int i = _keys.size() - 1; i >= 0; i--) {
-      g13.SendEvent(EV_KEY, _keys[i], !is_down);
-      G13_LOG(log4cpp::Priority::DEBUG << "sending KEY UP " << _keys[i]);
+    if (up_count) for (int i = down_count - 1; i >= 0; i--) {
+      SendKey(g13, keys[i], !is_down);
+      G13_DBG("sending KEY UP " << keys[i]);
     }
   } else {
-    if(_keysup.empty()) for (int i = _keys.size() - 1; i >= 0; i--) {
-      g13.SendEvent(EV_KEY, _keys[i], is_down);
-      G13_LOG(log4cpp::Priority::DEBUG << "sending KEY UP " << _keys[i]);
+    if (!up_count) for (int i = down_count - 1; i >= 0; i--) {
+      SendKey(g13, keys[i], is_down);
+      G13_DBG("sending KEY UP " << keys[i]);
     } else {
-      for (int &_key : _keysup) {
-        g13.SendEvent(EV_KEY, _key, !is_down);
-        G13_LOG(log4cpp::Priority::DEBUG << "sending KEY DOWN " << _key);
+      for (int i = 0; i < up_count; i++) {
+        SendKey(g13, up_keys[i], !is_down);
+        G13_DBG("sending KEY DOWN " << up_keys[i]);
       }
-      for (int i = _keysup.size() - 1; i >= 0; i--) {
-        g13.SendEvent(EV_KEY, _keysup[i], is_down);
-        G13_LOG(log4cpp::Priority::DEBUG << "sending KEY UP " << _keysup[i]);
+      for (int i = up_count - 1; i >= 0; i--) {
+        SendKey(g13, up_keys[i], is_down);
+        G13_DBG("sending KEY UP " << up_keys[i]);
       }
     }
   }
@@ -72,42 +103,31 @@ void G13_Action_Keys::act(G13_Device &g13, bool is_down) {
 void G13_Action_Keys::dump(std::ostream &out) const {
   out << " SEND KEYS: ";
 
-  for (size_t i = 0; i < _keys.size(); i++) {
+  for (size_t i = 0; i < down_count; i++) {
     if (i)
       out << " + ";
-    out << G13_Manager::Instance()->FindInputKeyName(_keys[i]);
+    out << G13_Manager::Instance()->FindInputKeyName(keys[i]);
   }
 }
 
-G13_Action_PipeOut::G13_Action_PipeOut(G13_Device &keypad,
-                                       const std::string &out)
-    : G13_Action(keypad), _out(out + "\n") {}
-
-G13_Action_PipeOut::~G13_Action_PipeOut() = default;
-
-void G13_Action_PipeOut::act(G13_Device &kp, bool is_down) {
+void G13_Action_PipeOut::act(G13_Device &kp, bool is_down) const {
   if (is_down) {
-    kp.OutputPipeWrite(_out);
+    kp.OutputPipeWrite(out, size);
   }
 }
 
 void G13_Action_PipeOut::dump(std::ostream &o) const {
-  o << "WRITE PIPE : " << Helper::repr(_out);
+  o << "WRITE PIPE : " << Helper::repr(out);
 }
 
-G13_Action_Command::G13_Action_Command(G13_Device &keypad, std::string cmd)
-    : G13_Action(keypad), _cmd(std::move(cmd)) {}
-
-G13_Action_Command::~G13_Action_Command() = default;
-
-void G13_Action_Command::act(G13_Device &kp, bool is_down) {
+void G13_Action_Command::act(G13_Device &kp, bool is_down) const {
   if (is_down) {
-    keypad().Command(_cmd.c_str());
+    kp.RunCommand(compiled);
   }
 }
 
 void G13_Action_Command::dump(std::ostream &o) const {
-  o << "COMMAND : " << Helper::repr(_cmd);
+  o << "COMMAND : " << Helper::repr(cmd);
 }
 
 /*
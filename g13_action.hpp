@@ -6,10 +6,12 @@
 #define G13_G13_ACTION_HPP
 
 #include "g13.hpp"
+#include "g13_command.hpp"
 #include "g13_keys.hpp"
 #include "g13_manager.hpp"
 #include "g13_stick.hpp"
 #include <memory>
+#include <variant>
 #include <vector>
 
 namespace G13 {
@@ -23,75 +25,89 @@ class G13_Profile;
 
 // *************************************************************************
 
-/*! holds potential actions which can be bound to G13 activity
- *
- */
-class G13_Action {
-public:
-  explicit G13_Action(G13_Device &keypad) : _keypad(keypad) {}
-  virtual ~G13_Action();
-
-  virtual void act(G13_Device &, bool is_down) = 0;
-  virtual void dump(std::ostream &) const = 0;
-
-  void act(bool is_down) { act(keypad(), is_down); }
-
-  G13_Device &keypad() { return _keypad; }
-
-  // [[maybe_unused]] [[nodiscard]] const G13_Device& keypad() const { return
-  // m_keypad; }
-
-  // [[nodiscard]] const G13_Manager& manager() const;
-
-private:
-  G13_Device &_keypad;
-};
-
-typedef std::shared_ptr<G13_Action> G13_ActionPtr;
+const size_t G13_MAX_ACTION_KEYS = 32; // in one G13_Action_Keys
 
 /*!
  * action to send one or more keystrokes
+ *
+ * The key codes live in the arena the action was made in, the keys pressed
+ * and released on key down come first, followed by those sent on key up.
+ * REL_ codes (see G13_REL_FLAG) move their axis by one step when pressed.
  */
-class G13_Action_Keys : public G13_Action {
-public:
-  G13_Action_Keys(G13_Device &keypad, const std::string &keys);
-  ~G13_Action_Keys() override;
-
-  void act(G13_Device &, bool is_down) override;
-  void dump(std::ostream &) const override;
+struct G13_Action_Keys {
+  void act(G13_Device &, bool is_down) const;
+  void dump(std::ostream &) const;
 
-  std::vector<LINUX_KEY_VALUE> _keys;
-  std::vector<LINUX_KEY_VALUE> _keysup;
+  const LINUX_KEY_VALUE *keys;
+  unsigned short down_count;
+  unsigned short up_count;
 };
 
 /*!
  * action to send a string to the output pipe
  */
-class G13_Action_PipeOut : public G13_Action {
-public:
-  G13_Action_PipeOut(G13_Device &keypad, const std::string &out);
-  ~G13_Action_PipeOut() override;
-
-  void act(G13_Device &, bool is_down) override;
-  void dump(std::ostream &) const override;
+struct G13_Action_PipeOut {
+  void act(G13_Device &, bool is_down) const;
+  void dump(std::ostream &) const;
 
-  std::string _out;
+  const char *out; // including the newline
+  size_t size;
 };
 
 /*!
  * action to send a command to the g13
+ *
+ * The command is compiled when it is bound, a key press only runs it.
+ */
+struct G13_Action_Command {
+  void act(G13_Device &, bool is_down) const;
+  void dump(std::ostream &) const;
+
+  const char *cmd; // the text compiled points into
+  G13_Command compiled;
+};
+
+/*! holds potential actions which can be bound to G13 activity
+ *
+ * A closed set of plain structs, allocated in a Helper::Arena together with
+ * the data they point to. Bindings hold plain pointers to them, and dropping
+ * the arena drops all of its actions at once.
  */
-class G13_Action_Command : public G13_Action {
+class G13_Action {
 public:
-  G13_Action_Command(G13_Device &keypad, std::string cmd);
-  ~G13_Action_Command() override;
+  typedef std::variant<G13_Action_Keys, G13_Action_PipeOut, G13_Action_Command>
+      KIND;
 
-  void act(G13_Device &, bool is_down) override;
-  void dump(std::ostream &) const override;
+  explicit G13_Action(const KIND &kind) : _kind(kind) {}
+
+  // parses an action string, as taken by bind, into arena
+  static const G13_Action *Make(std::string_view action,
+                                Helper::Arena &arena);
+
+  void act(G13_Device &g13, bool is_down) const {
+    std::visit([&](const auto &action) { action.act(g13, is_down); }, _kind);
+  }
+
+  void dump(std::ostream &o) const {
+    std::visit([&](const auto &action) { action.dump(o); }, _kind);
+  }
+
+  // the keystrokes sent, if this is a G13_Action_Keys
+  [[nodiscard]] const G13_Action_Keys *keys() const {
+    return std::get_if<G13_Action_Keys>(&_kind);
+  }
+
+  // the command run, if this is a G13_Action_Command
+  [[nodiscard]] const G13_Action_Command *command() const {
+    return std::get_if<G13_Action_Command>(&_kind);
+  }
 
-  std::string _cmd;
+protected:
+  KIND _kind;
 };
 
+typedef const G13_Action *G13_ActionPtr;
+
 // *************************************************************************
 template <class PARENT_T> class G13_Actionable {
 public:
@@ -107,61 +123,22 @@ public:
   // [[nodiscard]] const G13_Manager& manager() const { return
   // _parent_ptr->manager(); }
 
-  virtual void set_action(const G13_ActionPtr &action) { _action = action; }
+  virtual void set_action(G13_ActionPtr action) { _action = action; }
 
 protected:
   std::string _name;
-  G13_ActionPtr _action;
+  G13_ActionPtr _action = nullptr;
 
 private:
   PARENT_T *_parent_ptr;
 };
 
-// *************************************************************************
-/*! manages the bindings for a G13 key
- *
- */
-class G13_Key : public G13_Actionable<G13_Profile> {
-public:
-  void dump(std::ostream &o) const;
-  [[nodiscard]] G13_KEY_INDEX index() const { return _index.index; }
-
-  void ParseKey(const unsigned char *byte, G13_Device *g13);
-
-protected:
-  struct KeyIndex {
-    explicit KeyIndex(int key)
-        : index(key), offset(key / 8u), mask(1u << (key % 8u)) {}
-
-    int index;
-    unsigned char offset;
-    unsigned char mask;
-  };
-
-  // G13_Profile is the only class able to instantiate G13_Keys
-  friend class G13_Profile;
-
-  G13_Key(G13_Profile &mode, const std::string &name, int index)
-      : G13_Actionable<G13_Profile>(mode, name), _index(index),
-        _should_parse(true) {}
-
-  G13_Key(G13_Profile &mode, const G13_Key &key)
-      : G13_Actionable<G13_Profile>(mode, key.name()), _index(key._index),
-        _should_parse(key._should_parse) {
-    set_action(
-        key.action()); // TODO: do not invoke virtual member function from ctor
-  }
-
-  KeyIndex _index;
-  bool _should_parse;
-};
-
 // *************************************************************************
 
 class G13_StickZone : public G13_Actionable<G13_Stick> {
 public:
   G13_StickZone(G13_Stick &, const std::string &name, const G13_ZoneBounds &,
-                const G13_ActionPtr& = nullptr);
+                G13_ActionPtr = nullptr);
 
   bool operator==(const G13_StickZone &other) const {
     return _name == other._name;
@@ -170,7 +147,9 @@ public:
   void dump(std::ostream &) const;
 
   // void ParseKey(unsigned char* byte, G13_Device* g13);
-  void test(const G13_ZoneCoord &loc);
+  void test(G13_Device &g13, const G13_ZoneCoord &loc);
+  // lets go of the zone's action if the stick is in it
+  void release(G13_Device &g13);
   void set_bounds(const G13_ZoneBounds &bounds) { _bounds = bounds; }
 
 protected:
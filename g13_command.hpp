@@ -0,0 +1,46 @@
+/* This file contains the compiled form of g13d commands
+ *
+ */
+
+#ifndef G13_G13_COMMAND_HPP
+#define G13_G13_COMMAND_HPP
+
+#include <string_view>
+
+namespace Helper {
+class Tokenizer;
+}
+
+namespace G13 {
+class G13_Action;
+class G13_Device;
+
+/*! arguments of a command, parsed once
+ *
+ * Which fields are used is up to the command. The strings point into the
+ * command text, which has to outlive the arguments.
+ */
+struct G13_CommandArgs {
+  int i[4];
+  double d[4];
+  std::string_view word; // a single word argument, not NUL terminated
+  const char *rest;      // the rest of the line
+  const char *action;    // the action bound, for commands binding one
+  const G13_Action *made; // action made in advance, see G13_Config
+};
+
+typedef void (*COMMAND_PARSE)(Helper::Tokenizer &tokens, G13_CommandArgs &args);
+typedef void (*COMMAND_RUN)(G13_Device &g13, const G13_CommandArgs &args);
+
+/*! a command with its handler resolved and arguments parsed
+ *
+ * Running it is a single call, see G13_Device::CompileCommand().
+ */
+struct G13_Command {
+  COMMAND_RUN run;
+  G13_CommandArgs args;
+};
+
+} // namespace G13
+
+#endif // G13_G13_COMMAND_HPP
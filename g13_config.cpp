@@ -0,0 +1,217 @@
+/* This file contains the configuration shared by all devices
+ *
+ */
+
+#include "g13_config.hpp"
+#include "g13.hpp"
+#include "g13_action.hpp"
+#include "g13_device.hpp"
+#include "g13_profile.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+namespace G13 {
+
+std::shared_ptr<const G13_Config> G13_Config::Load(const std::string &filename) {
+  std::shared_ptr<G13_Config> config(new G13_Config(filename));
+  G13_OUT("reading configuration from " << filename);
+  bool ok = G13_ConfigImage::IsImage(filename) ? config->ReadImage()
+                                               : config->ReadText(0, 0);
+  if (!ok) {
+    return nullptr;
+  }
+  config->MakeActions();
+  config->RecordProfiles();
+  return config;
+}
+
+bool G13_Config::Stale() const {
+  for (size_t i = 0; i < m_files.size(); i++) {
+    struct stat st {};
+    auto &was = m_stats[i];
+    if (stat(m_files[i].c_str(), &st) < 0) {
+      // an include that was missing then too has an all zero stat
+      if (was.st_ino == 0) {
+        continue;
+      }
+      return true;
+    }
+    if (st.st_dev != was.st_dev || st.st_ino != was.st_ino ||
+        st.st_size != was.st_size ||
+        st.st_mtim.tv_sec != was.st_mtim.tv_sec ||
+        st.st_mtim.tv_nsec != was.st_mtim.tv_nsec) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string G13_Config::Included(const std::string &filename,
+                                 const char *line) {
+  Helper::Tokenizer tokens(line);
+  if (tokens.next() != "include") {
+    return "";
+  }
+  std::string name(tokens.next());
+  if (name.empty() || name[0] == '/') {
+    return name;
+  }
+  auto slash = filename.rfind('/');
+  return slash == std::string::npos ? name
+                                    : filename.substr(0, slash + 1) + name;
+}
+
+/*! compiles every line of a bindfile, lines that do not compile are logged
+ * and left out, includes are read in place
+ */
+bool G13_Config::ReadText(size_t file, int depth) {
+  // m_files grows while reading, keep a copy of the name
+  const std::string filename = m_files[file];
+  std::ifstream s(filename);
+  struct stat st {};
+  if (s.fail() || stat(filename.c_str(), &st) < 0) {
+    G13_ERR("Could not read " << filename << ": " << strerror(errno));
+    return false;
+  }
+  m_stats.push_back(st);
+
+  std::string line;
+  for (uint32_t number = 1; std::getline(s, line); number++) {
+    Helper::strip_comment(line.data());
+    const char *str = m_arena.Copy(std::string_view(line.c_str()));
+    if (!*str) {
+      continue;
+    }
+    auto included = Included(filename, str);
+    if (!included.empty()) {
+      if (depth == G13_MAX_INCLUDE_DEPTH) {
+        G13_ERR(filename << ":" << number << ": includes nested too deep");
+        continue;
+      }
+      m_files.push_back(included);
+      if (!ReadText(m_files.size() - 1, depth + 1)) {
+        // still watched, it may yet be created
+        m_stats.resize(m_files.size());
+      }
+      continue;
+    }
+    G13_DBG("  cfg: " << str);
+    G13_Command command{};
+    try {
+      if (!G13_Device::CompileCommand(str, command)) {
+        G13_ERR(filename << ":" << number << ": unknown command : " << str);
+        continue;
+      }
+    } catch (const std::exception &ex) {
+      G13_ERR(filename << ":" << number << ": " << ex.what());
+      continue;
+    }
+    m_commands.push_back(command);
+    m_origins.push_back({static_cast<uint32_t>(file), number});
+  }
+  return true;
+}
+
+bool G13_Config::ReadImage() {
+  struct stat st {};
+  if (stat(filename().c_str(), &st) < 0 || !m_image.Open(filename())) {
+    return false;
+  }
+  m_stats.push_back(st);
+  for (size_t i = 0; i < m_image.size(); i++) {
+    m_commands.push_back(m_image.command(i));
+    m_origins.push_back({0, m_image.line(i)});
+  }
+  return true;
+}
+
+// makes the actions bound by the commands, once for all devices
+void G13_Config::MakeActions() {
+  size_t kept = 0;
+  for (size_t i = 0; i < m_commands.size(); i++) {
+    auto &args = m_commands[i].args;
+    if (args.action) {
+      try {
+        args.made = G13_Action::Make(args.action, m_arena);
+      } catch (const std::exception &ex) {
+        G13_ERR(m_files[m_origins[i].file] << ":" << m_origins[i].line << ": "
+                                           << ex.what());
+        continue;
+      }
+    }
+    m_commands[kept] = m_commands[i];
+    m_origins[kept++] = m_origins[i];
+  }
+  m_commands.resize(kept);
+  m_origins.resize(kept);
+}
+
+/*! sorts the key bindings below profile lines into ProfileRecords
+ *
+ * Those of "default", which every device has from the start, are left to be
+ * run like any other command, as are bindings on stick zones.
+ */
+void G13_Config::RecordProfiles() {
+  auto bind = G13_Device::FindCommand("bind");
+  auto profile = G13_Device::FindCommand("profile");
+  m_recorded.assign(m_commands.size(), false);
+  std::string_view current = "default";
+  for (size_t i = 0; i < m_commands.size(); i++) {
+    auto &command = m_commands[i];
+    if (command.run == profile) {
+      std::string_view name = command.args.rest;
+      if (name != "default" && !m_profiles.count(name)) {
+        m_profiles[name].parent = current;
+      }
+      current = m_selected = name;
+      m_recorded[i] = true;
+    } else if (command.run == bind && current != "default") {
+      auto key = G13_Profile::FindKey(std::string(command.args.word));
+      if (key >= 0) {
+        m_profiles[current].bindings.emplace_back(key, command.args.made);
+        m_recorded[i] = true;
+      }
+    }
+  }
+}
+
+const G13_Config::ProfileRecord *
+G13_Config::profile(std::string_view name) const {
+  auto i = m_profiles.find(name);
+  return i == m_profiles.end() ? nullptr : &i->second;
+}
+
+std::map<G13_Config::BindingTarget, const G13_Command *>
+G13_Config::Bindings() const {
+  auto bind = G13_Device::FindCommand("bind");
+  auto profile = G13_Device::FindCommand("profile");
+  std::map<BindingTarget, const G13_Command *> bindings;
+  std::string_view current = "default";
+  for (auto &command : m_commands) {
+    if (command.run == profile) {
+      current = command.args.rest;
+    } else if (command.args.action) {
+      // bind takes key names first, stickzone action only zones
+      bool key = command.run == bind &&
+                 G13_Profile::FindKey(std::string(command.args.word)) >= 0;
+      bindings[{key ? current : "", command.args.word}] = &command;
+    }
+  }
+  return bindings;
+}
+
+bool G13_Config::Same(const G13_Command &a, const G13_Command &b) {
+  auto text = [](const char *str) {
+    return str ? std::string_view(str) : std::string_view();
+  };
+  return a.run == b.run && a.args.word == b.args.word &&
+         text(a.args.rest) == text(b.args.rest) &&
+         text(a.args.action) == text(b.args.action) &&
+         std::equal(std::begin(a.args.i), std::end(a.args.i),
+                    std::begin(b.args.i)) &&
+         std::equal(std::begin(a.args.d), std::end(a.args.d),
+                    std::begin(b.args.d));
+}
+
+} // namespace G13
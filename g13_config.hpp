@@ -0,0 +1,114 @@
+/* This file contains the configuration shared by all devices
+ *
+ */
+
+#ifndef G13_G13_CONFIG_HPP
+#define G13_G13_CONFIG_HPP
+
+#include "g13_command.hpp"
+#include "g13_config_image.hpp"
+#include "g13_keys.hpp"
+#include "helper.hpp"
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace G13 {
+
+/*!
+ * a configuration file, parsed once and then only read
+ *
+ * Every line is compiled into a G13_Command, and the actions bound by them
+ * are made up front, so applying the configuration to a device only runs the
+ * commands, see G13_Device::ApplyConfig(). Devices hold on to the
+ * configurations they were given, as their profiles point to its actions.
+ *
+ * The key bindings of every profile but "default" are not run but kept as a
+ * ProfileRecord, a device only makes the profile from it the first time it is
+ * selected, see G13_Device::Profile().
+ *
+ * A bindfile may pull in others with "include <file>", relative to its own
+ * directory. G13_Manager::Config() keeps the current configuration and
+ * G13_Manager::ReloadConfig() loads it again once any of its files changed,
+ * see G13_Device::ReloadConfig() for how devices move over.
+ */
+class G13_Config {
+public:
+  // a bindfile, or an image of one made by g13c; nullptr if it can't be read
+  static std::shared_ptr<const G13_Config> Load(const std::string &filename);
+
+  [[nodiscard]] const std::string &filename() const { return m_files[0]; }
+
+  // filename and every file it includes
+  [[nodiscard]] const std::vector<std::string> &files() const {
+    return m_files;
+  }
+
+  [[nodiscard]] const std::vector<G13_Command> &commands() const {
+    return m_commands;
+  }
+
+  // whether any of the files is no longer the one this was loaded from
+  [[nodiscard]] bool Stale() const;
+
+  // what a binding is made on: a profile and key, or "" and a stick zone
+  typedef std::pair<std::string_view, std::string_view> BindingTarget;
+
+  // the command making the last binding on each target, keys are taken to be
+  // bound on the profile selected last, starting from "default"
+  [[nodiscard]] std::map<BindingTarget, const G13_Command *> Bindings() const;
+
+  // the key bindings made on a profile, in order
+  struct ProfileRecord {
+    std::string_view parent; // the profile selected before it first was
+    std::vector<std::pair<G13_KEY_INDEX, const G13_Action *>> bindings;
+  };
+
+  // nullptr if the profile is not one of those recorded
+  [[nodiscard]] const ProfileRecord *profile(std::string_view name) const;
+
+  // whether a command is one of those kept in a ProfileRecord, or selects a
+  // profile, rather than one to run
+  [[nodiscard]] bool recorded(size_t index) const { return m_recorded[index]; }
+
+  // the profile selected last, empty if none is
+  [[nodiscard]] std::string_view selected() const { return m_selected; }
+
+  // whether two commands came from the same line, give or take spacing
+  static bool Same(const G13_Command &a, const G13_Command &b);
+
+  // the file an include line names, empty if line is not an include
+  static std::string Included(const std::string &filename, const char *line);
+
+  static constexpr int G13_MAX_INCLUDE_DEPTH = 8;
+
+protected:
+  explicit G13_Config(std::string filename) : m_files{std::move(filename)} {}
+
+  bool ReadText(size_t file, int depth);
+  bool ReadImage();
+  void MakeActions();
+  void RecordProfiles();
+
+  // where a command came from, for messages
+  struct Origin {
+    uint32_t file; // in m_files
+    uint32_t line;
+  };
+
+  std::vector<std::string> m_files;
+  std::vector<struct stat> m_stats; // of m_files when they were loaded
+  std::vector<G13_Command> m_commands;
+  std::vector<Origin> m_origins; // of the commands
+  std::map<std::string_view, ProfileRecord, std::less<>> m_profiles;
+  std::vector<bool> m_recorded; // by command
+  std::string_view m_selected;
+  Helper::Arena m_arena;         // the text and actions of the commands
+  G13_ConfigImage m_image;
+};
+
+} // namespace G13
+
+#endif // G13_G13_CONFIG_HPP
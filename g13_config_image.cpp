@@ -0,0 +1,261 @@
+/* This file contains the compiled form of bindfiles, see g13c
+ *
+ */
+
+#include "g13_config_image.hpp"
+#include "g13.hpp"
+#include "g13_action.hpp"
+#include "g13_config.hpp"
+#include "g13_device.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace G13 {
+
+const char G13_ConfigImage::MAGIC[4] = {'G', '1', '3', 'C'};
+
+G13_ConfigImage::~G13_ConfigImage() { Close(); }
+
+void G13_ConfigImage::Close() {
+  if (m_map) {
+    munmap(m_map, m_map_size);
+    m_map = nullptr;
+  }
+  m_records = nullptr;
+  m_commands.clear();
+}
+
+/*! the state of one Compile(), included files are compiled in place so the
+ * image does not refer to them
+ */
+class G13_ConfigImage::Compiler {
+public:
+  explicit Compiler(std::ostream &errors) : errors(errors) {}
+
+  void File(const std::string &filename, int depth);
+
+  std::ostream &errors;
+  std::vector<Record> records;
+  std::map<std::string, uint32_t, std::less<>> names;
+  std::string text;
+  Helper::Arena scratch; // for the actions made to check them
+  bool ok = true;
+};
+
+void G13_ConfigImage::Compiler::File(const std::string &filename, int depth) {
+  std::ifstream in(filename);
+  if (in.fail()) {
+    errors << filename << ": " << strerror(errno) << std::endl;
+    ok = false;
+    return;
+  }
+
+  std::string line;
+  for (uint32_t number = 1; std::getline(in, line); number++) {
+    Helper::strip_comment(line.data());
+    line.resize(strlen(line.c_str()));
+    if (line.empty()) {
+      continue;
+    }
+    auto error = [&](const std::string &message) {
+      errors << filename << ":" << number << ": " << message << std::endl;
+      ok = false;
+    };
+
+    const char *str = line.c_str();
+    auto included = G13_Config::Included(filename, str);
+    if (!included.empty()) {
+      if (depth == G13_Config::G13_MAX_INCLUDE_DEPTH) {
+        error("includes nested too deep");
+      } else {
+        File(included, depth + 1);
+      }
+      continue;
+    }
+    G13_Command command{};
+    try {
+      if (!G13_Device::CompileCommand(str, command)) {
+        error("unknown command : " + line);
+        continue;
+      }
+      if (command.args.action) {
+        G13_Action::Make(command.args.action, scratch);
+      }
+    } catch (const G13_CommandException &ex) {
+      error(ex.what());
+      continue;
+    }
+
+    auto base = static_cast<uint32_t>(text.size());
+    auto offset = [&](const char *p) {
+      return p ? base + static_cast<uint32_t>(p - str) : NONE;
+    };
+    auto name = Helper::Tokenizer(str).next();
+    auto i = names.find(name);
+    if (i == names.end()) {
+      i = names.emplace(std::string(name), names.size()).first;
+    }
+
+    Record record{};
+    record.name = i->second;
+    record.line = number;
+    record.word = command.args.word.empty() ? NONE
+                                            : offset(command.args.word.data());
+    record.word_size = command.args.word.size();
+    record.rest = offset(command.args.rest);
+    record.action = offset(command.args.action);
+    std::copy(std::begin(command.args.i), std::end(command.args.i), record.i);
+    std::copy(std::begin(command.args.d), std::end(command.args.d), record.d);
+    records.push_back(record);
+    text.append(line.c_str(), line.size() + 1);
+  }
+}
+
+bool G13_ConfigImage::Compile(const std::string &source,
+                              const std::string &target,
+                              std::ostream &errors) {
+  Compiler compiler(errors);
+  compiler.File(source, 0);
+  if (!compiler.ok) {
+    return false;
+  }
+  auto &records = compiler.records;
+  auto &names = compiler.names;
+  auto &text = compiler.text;
+
+  std::vector<uint32_t> name_offsets(names.size());
+  for (auto &name : names) {
+    name_offsets[name.second] = text.size();
+    text.append(name.first.c_str(), name.first.size() + 1);
+  }
+
+  Header header{};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = G13_IMAGE_VERSION;
+  header.command_count = records.size();
+  header.name_count = name_offsets.size();
+  header.text_size = text.size();
+
+  std::ofstream out(target, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(records.data()),
+            records.size() * sizeof(Record));
+  out.write(reinterpret_cast<const char *>(name_offsets.data()),
+            name_offsets.size() * sizeof(uint32_t));
+  out.write(text.data(), text.size());
+  out.close();
+  if (out.fail()) {
+    errors << target << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool G13_ConfigImage::IsImage(const std::string &filename) {
+  char magic[sizeof(MAGIC)];
+  std::ifstream in(filename, std::ios::binary);
+  return in.read(magic, sizeof(magic)) && !memcmp(magic, MAGIC, sizeof(MAGIC));
+}
+
+/*! maps filename and turns its records into commands
+ *
+ * Everything is checked against the size of the file, so that a truncated or
+ * damaged image is refused rather than read out of bounds.
+ */
+bool G13_ConfigImage::Open(const std::string &filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    G13_ERR("Could not open " << filename << ": " << strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  m_map_size = st.st_size;
+  m_map = m_map_size ? mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, fd, 0)
+                     : MAP_FAILED;
+  close(fd);
+  if (m_map == MAP_FAILED) {
+    m_map = nullptr;
+    G13_ERR("Could not map " << filename);
+    return false;
+  }
+
+  auto fail = [&](const char *reason) {
+    G13_ERR(filename << " is not a usable image: " << reason);
+    Close();
+    return false;
+  };
+  auto base = static_cast<const char *>(m_map);
+  auto header = reinterpret_cast<const Header *>(base);
+  if (m_map_size < sizeof(Header) ||
+      memcmp(header->magic, MAGIC, sizeof(MAGIC))) {
+    return fail("bad magic");
+  }
+  if (header->version != G13_IMAGE_VERSION) {
+    return fail("made by another version of g13c");
+  }
+  uint64_t expected = sizeof(Header) +
+                      uint64_t(header->command_count) * sizeof(Record) +
+                      uint64_t(header->name_count) * sizeof(uint32_t) +
+                      header->text_size;
+  if (expected != m_map_size) {
+    return fail("truncated");
+  }
+  m_records = reinterpret_cast<const Record *>(base + sizeof(Header));
+  auto name_offsets =
+      reinterpret_cast<const uint32_t *>(m_records + header->command_count);
+  const char *text =
+      reinterpret_cast<const char *>(name_offsets + header->name_count);
+  if (header->text_size == 0 || text[header->text_size - 1] != 0) {
+    return fail("text not terminated");
+  }
+  auto at = [&](uint32_t offset) {
+    return offset == NONE ? nullptr : text + offset;
+  };
+
+  // one lookup per command name, not per line
+  std::vector<COMMAND_RUN> runs(header->name_count);
+  for (uint32_t i = 0; i < header->name_count; i++) {
+    if (name_offsets[i] >= header->text_size ||
+        !(runs[i] = G13_Device::FindCommand(text + name_offsets[i]))) {
+      return fail("unknown command");
+    }
+  }
+
+  m_commands.resize(header->command_count);
+  for (uint32_t i = 0; i < header->command_count; i++) {
+    auto &record = m_records[i];
+    if (record.name >= header->name_count ||
+        (record.word != NONE &&
+         uint64_t(record.word) + record.word_size > header->text_size) ||
+        (record.rest != NONE && record.rest >= header->text_size) ||
+        (record.action != NONE && record.action >= header->text_size)) {
+      return fail("bad record");
+    }
+    auto &command = m_commands[i];
+    command.run = runs[record.name];
+    if (record.word != NONE) {
+      command.args.word = std::string_view(at(record.word), record.word_size);
+    }
+    command.args.rest = at(record.rest);
+    command.args.action = at(record.action);
+    std::copy(std::begin(record.i), std::end(record.i), command.args.i);
+    std::copy(std::begin(record.d), std::end(record.d), command.args.d);
+  }
+  return true;
+}
+
+uint32_t G13_ConfigImage::line(size_t index) const {
+  return m_records[index].line;
+}
+
+} // namespace G13
@@ -0,0 +1,97 @@
+/* This file contains the compiled form of bindfiles, see g13c
+ *
+ */
+
+#ifndef G13_G13_CONFIG_IMAGE_HPP
+#define G13_G13_CONFIG_IMAGE_HPP
+
+#include "g13_command.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace G13 {
+
+/*!
+ * a bindfile with every line already parsed into a G13_Command
+ *
+ * g13c runs the text through the same parsers the daemon uses, and reports
+ * syntax errors, unknown commands and unknown keys in bound actions. What it
+ * writes is the parsed arguments, so that g13d only has to map the file and
+ * run them, skipping tokenizing, number parsing and most lookups.
+ *
+ * Layout, all in native byte order:
+ *   Header
+ *   Record[command_count]
+ *   uint32_t name_offsets[name_count], into the text
+ *   text: the NUL terminated command lines and names
+ *
+ * The arguments are only meaningful to the parsers they came from, so
+ * G13_IMAGE_VERSION has to change whenever a parser does.
+ */
+class G13_ConfigImage {
+public:
+  static constexpr uint32_t G13_IMAGE_VERSION = 1;
+
+  G13_ConfigImage() = default;
+  ~G13_ConfigImage();
+  G13_ConfigImage(const G13_ConfigImage &) = delete;
+  G13_ConfigImage &operator=(const G13_ConfigImage &) = delete;
+
+  // compiles the bindfile at source into an image at target, false if there
+  // were errors, which are written to errors
+  static bool Compile(const std::string &source, const std::string &target,
+                      std::ostream &errors);
+
+  // whether filename starts like an image, of any version
+  static bool IsImage(const std::string &filename);
+
+  // maps an image, false (and logged) if it is not one this g13d can use
+  bool Open(const std::string &filename);
+
+  [[nodiscard]] size_t size() const { return m_commands.size(); }
+
+  // the commands point into the mapping, they are valid until the image goes
+  [[nodiscard]] const G13_Command &command(size_t index) const {
+    return m_commands[index];
+  }
+  [[nodiscard]] uint32_t line(size_t index) const;
+
+protected:
+  static const char MAGIC[4];
+  static constexpr uint32_t NONE = UINT32_MAX; // a null pointer, as an offset
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t command_count;
+    uint32_t name_count;
+    uint32_t text_size;
+    uint32_t reserved;
+  };
+
+  struct Record {
+    uint32_t name;   // index in name_offsets
+    uint32_t line;   // in the bindfile, for messages
+    uint32_t word;   // offsets into the text, or NONE
+    uint32_t word_size;
+    uint32_t rest;
+    uint32_t action;
+    int32_t i[4];
+    double d[4];
+  };
+
+  class Compiler;
+
+  void Close();
+
+  void *m_map = nullptr;
+  size_t m_map_size = 0;
+  const Record *m_records = nullptr;
+  std::vector<G13_Command> m_commands;
+};
+
+} // namespace G13
+
+#endif // G13_G13_CONFIG_IMAGE_HPP
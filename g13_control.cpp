@@ -0,0 +1,207 @@
+/* This file contains the control socket g13d serves its clients on
+ *
+ */
+
+#include "g13_control.hpp"
+#include "g13.hpp"
+#include "g13_device.hpp"
+#include "g13_manager.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace G13 {
+
+bool G13_ControlServer::Listen(const std::string &path, mode_t mode) {
+  struct sockaddr_un addr {};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    G13_ERR("control socket path too long: " << path);
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  m_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (m_listen_fd < 0) {
+    G13_ERR("Could not create control socket: " << strerror(errno));
+    return false;
+  }
+  unlink(path.c_str());
+  // nobody else may connect before the chmod() below
+  auto mask = umask(0077);
+  bool bound = bind(m_listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                    sizeof(addr)) == 0;
+  umask(mask);
+  if (!bound || listen(m_listen_fd, 16) < 0) {
+    G13_ERR("Could not listen on " << path << ": " << strerror(errno));
+    close(m_listen_fd);
+    m_listen_fd = -1;
+    return false;
+  }
+  chmod(path.c_str(), mode);
+  m_path = path;
+
+  G13_Manager::Reactor().Watch(m_listen_fd, EPOLLIN,
+                               [this](uint32_t) { Accept(); });
+  G13_OUT("Listening for control clients on " << path);
+  return true;
+}
+
+void G13_ControlServer::Close() {
+  while (!m_clients.empty()) {
+    Disconnect(m_clients.begin()->first);
+  }
+  if (m_listen_fd >= 0) {
+    G13_Manager::Reactor().Unwatch(m_listen_fd);
+    close(m_listen_fd);
+    m_listen_fd = -1;
+    unlink(m_path.c_str());
+  }
+}
+
+void G13_ControlServer::Accept() {
+  int fd;
+  while ((fd = accept4(m_listen_fd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    auto client = std::make_unique<Client>();
+    client->fd = fd;
+    m_clients[fd] = std::move(client);
+    G13_Manager::Reactor().Watch(fd, EPOLLIN, [this, fd](uint32_t events) {
+      HandleClient(fd, events);
+    });
+    G13_DBG("control client " << fd << " connected");
+  }
+}
+
+void G13_ControlServer::HandleClient(int fd, uint32_t events) {
+  auto iter = m_clients.find(fd);
+  if (iter == m_clients.end()) {
+    return;
+  }
+  Client &client = *iter->second;
+
+  if (events & EPOLLOUT) {
+    while (!client.replies.empty()) {
+      auto &reply = client.replies.front();
+      if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT) <
+          0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        Disconnect(fd);
+        return;
+      }
+      client.replies.pop_front();
+    }
+    if (client.replies.empty()) {
+      G13_Manager::Reactor().Watch(fd, EPOLLIN, [this, fd](uint32_t events) {
+        HandleClient(fd, events);
+      });
+    }
+  }
+
+  if (events & EPOLLIN) {
+    while (true) {
+      ssize_t size = recv(fd, client.input.WritePtr(),
+                          client.input.WriteSpace(), MSG_DONTWAIT | MSG_TRUNC);
+      if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+      if (size <= 0) {
+        Disconnect(fd);
+        return;
+      }
+      if (static_cast<size_t>(size) > client.input.WriteSpace()) {
+        client.input.Clear();
+        Reply(client, "error: request too big\n");
+      } else {
+        client.input.Commit(size);
+        HandleRequest(client, size);
+      }
+      if (client.replies.size() > G13_CONTROL_MAX_REPLIES) {
+        G13_ERR("control client " << fd
+                                  << " does not read its replies, dropping it");
+        Disconnect(fd);
+        return;
+      }
+    }
+  } else if (events & (EPOLLHUP | EPOLLERR)) {
+    Disconnect(fd);
+  }
+}
+
+void G13_ControlServer::HandleRequest(Client &client, size_t size) {
+  const char *request = client.input.data() + client.input.size() - size;
+  if (size > 7 && !strncmp(request, "device ", 7)) {
+    client.device = atoi(request + 7);
+    auto line_end = static_cast<const char *>(memchr(request, '\n', size));
+    size_t rest = line_end ? request + size - (line_end + 1) : 0;
+    if (rest > 0) {
+      // the rest of the packet goes to the device just selected
+      client.input.Consume(line_end + 1 - client.input.data());
+      HandleRequest(client, rest);
+      return;
+    }
+    client.input.Clear();
+    Reply(client, G13_Manager::FindDevice(client.device)
+                      ? "ok\n"
+                      : "error: no device " + std::to_string(client.device) +
+                            "\n");
+    return;
+  }
+
+  G13_Device *g13 = G13_Manager::FindDevice(client.device);
+  if (!g13) {
+    client.input.Clear();
+    Reply(client, "error: no device " + std::to_string(client.device) + "\n");
+    return;
+  }
+
+  std::ostringstream output;
+  auto failed = g13->failed_commands();
+  g13->SetCommandOutput(&output);
+  g13->ProcessInput(client.input);
+  if (client.input.size() > 0 && client.input.data()[0] != 0 &&
+      client.input.WriteSpace() > 0) {
+    // the end of a packet also ends the command in it
+    *client.input.WritePtr() = '\n';
+    client.input.Commit(1);
+    g13->ProcessInput(client.input);
+  }
+  g13->SetCommandOutput(nullptr);
+
+  output << (g13->failed_commands() == failed ? "ok" : "error") << std::endl;
+  Reply(client, output.str());
+}
+
+void G13_ControlServer::Reply(Client &client, std::string reply) {
+  if (client.replies.empty()) {
+    if (send(client.fd, reply.data(), reply.size(),
+             MSG_NOSIGNAL | MSG_DONTWAIT) >= 0) {
+      return;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      G13_DBG("control client " << client.fd << ": " << strerror(errno));
+      return;
+    }
+    int fd = client.fd;
+    G13_Manager::Reactor().Watch(
+        fd, EPOLLIN | EPOLLOUT,
+        [this, fd](uint32_t events) { HandleClient(fd, events); });
+  }
+  client.replies.push_back(std::move(reply));
+}
+
+void G13_ControlServer::Disconnect(int fd) {
+  G13_DBG("control client " << fd << " disconnected");
+  G13_Manager::Reactor().Unwatch(fd);
+  close(fd);
+  m_clients.erase(fd);
+}
+
+} // namespace G13
@@ -0,0 +1,64 @@
+/* This file contains the control socket g13d serves its clients on
+ *
+ */
+
+#ifndef G13_G13_CONTROL_HPP
+#define G13_G13_CONTROL_HPP
+
+#include "helper.hpp"
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+namespace G13 {
+
+// replies queued for a client that does not read them before it is dropped
+const size_t G13_CONTROL_MAX_REPLIES = 64;
+
+/*!
+ * SOCK_SEQPACKET unix socket accepting any number of clients
+ *
+ * Every packet a client sends is a request: text commands and/or frames, as
+ * accepted on the input pipe, for the device the client has selected. Each
+ * request gets exactly one reply packet holding the output of the commands
+ * (e.g. dump) followed by a final "ok" or "error" line. The server itself
+ * understands a "device <id>" line at the start of a packet, which selects a
+ * device for it and the packets after it. Device 0 is the default.
+ * A client that lets more than G13_CONTROL_MAX_REPLIES replies pile up is
+ * disconnected.
+ */
+class G13_ControlServer {
+public:
+  G13_ControlServer() : m_listen_fd(-1) {}
+  ~G13_ControlServer() { Close(); }
+
+  bool Listen(const std::string &path, mode_t mode);
+  void Close();
+
+protected:
+  struct Client {
+    Client() : fd(-1), device(0) {}
+
+    int fd;
+    int device;
+    Helper::LineBuffer input;
+    std::deque<std::string> replies; // waiting for the socket to drain
+  };
+
+  void Accept();
+  void HandleClient(int fd, uint32_t events);
+  void HandleRequest(Client &client, size_t size);
+  void Reply(Client &client, std::string reply);
+  void Disconnect(int fd);
+
+  int m_listen_fd;
+  std::string m_path;
+  std::map<int, std::unique_ptr<Client>> m_clients;
+};
+
+} // namespace G13
+
+#endif // G13_G13_CONTROL_HPP
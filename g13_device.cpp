@@ -4,13 +4,15 @@
 
 #include "g13_device.hpp"
 #include "g13.hpp"
+#include "g13_config.hpp"
 #include "g13_fonts.hpp"
 #include "g13_log.hpp"
 #include "g13_manager.hpp"
 #include "g13_profile.hpp"
 #include "g13_stick.hpp"
 #include "logo.hpp"
-#include <fstream>
+#include <algorithm>
+#include <sys/epoll.h>
 #include <unistd.h>
 
 namespace G13 {
@@ -19,18 +21,14 @@ namespace G13 {
 G13_Device::G13_Device(libusb_device *dev, libusb_context *ctx,
                        libusb_device_handle *handle, int m_id)
     : m_lcd(*this), m_stick(*this), device(dev), handle(handle),
-      m_id_within_manager(m_id), m_uinput_fid(-1), m_ctx(ctx) {
+      m_id_within_manager(m_id), m_uinput_fid(-1), m_ctx(ctx),
+      m_port_path(PortPath(dev)) {
   m_currentProfile = std::make_shared<G13_Profile>(*this, "default");
   m_profiles["default"] = m_currentProfile;
 
-  for (bool &key : keys) {
-    key = false;
-  }
-
   lcd().image_clear();
 
   InitFonts();
-  InitCommands();
 }
 
 // *************************************************************************
@@ -92,21 +90,24 @@ int G13CreateUinput(G13_Device *g13) {
 
   ioctl(ufile, UI_SET_EVBIT, EV_KEY);
   ioctl(ufile, UI_SET_EVBIT, EV_ABS);
-  /*  ioctl(ufile, UI_SET_EVBIT, EV_REL);*/
   ioctl(ufile, UI_SET_MSCBIT, MSC_SCAN);
   ioctl(ufile, UI_SET_ABSBIT, ABS_X);
   ioctl(ufile, UI_SET_ABSBIT, ABS_Y);
-  /*  ioctl(ufile, UI_SET_RELBIT, REL_X);
-   ioctl(ufile, UI_SET_RELBIT, REL_Y);*/
-  for (int i = 0; i < 256; i++) {
-    ioctl(ufile, UI_SET_KEYBIT, i);
-  }
 
-  // Mouse buttons
-  for (int i = 0x110; i < 0x118; i++) {
-    ioctl(ufile, UI_SET_KEYBIT, i);
+  // only what the bindings can send, so that consumers see a minimal device
+  for (int i = 0; i < KEY_CNT; i++) {
+    if (g13->input_keys()[i]) {
+      ioctl(ufile, UI_SET_KEYBIT, i);
+    }
+  }
+  if (g13->input_rels().any()) {
+    ioctl(ufile, UI_SET_EVBIT, EV_REL);
+    for (int i = 0; i < REL_CNT; i++) {
+      if (g13->input_rels()[i]) {
+        ioctl(ufile, UI_SET_RELBIT, i);
+      }
+    }
   }
-  ioctl(ufile, UI_SET_KEYBIT, BTN_THUMB);
 
   int retcode = write(ufile, &uinp, sizeof(uinp));
   if (retcode < 0) {
@@ -123,45 +124,276 @@ int G13CreateUinput(G13_Device *g13) {
 
 // *************************************************************************
 
+static struct timespec MonotonicNow() {
+  struct timespec now {};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now;
+}
+
+/*! queues an event in the current frame
+ *
+ * Nothing is written until SYN_REPORT ends the frame (or it fills up), so all
+ * the events made while handling one report go to uinput in a single write().
+ * A SYN_REPORT ending an empty frame is dropped.
+ *
+ * Events made while handling a report carry the CLOCK_MONOTONIC time the
+ * report arrived at, anything else the time its frame was started.
+ */
 void G13_Device::SendEvent(int type, int code, int val) {
-  memset(&m_event, 0, sizeof(m_event));
-  gettimeofday(&m_event.time, nullptr);
-  m_event.type = type;
-  m_event.code = code;
-  m_event.value = val;
-  write(m_uinput_fid, &m_event, sizeof(m_event));
+  bool syn_report = type == EV_SYN && code == SYN_REPORT;
+  if (syn_report && m_event_frame_count == 0) {
+    return;
+  }
+  if (m_event_frame_count == G13_EVENT_FRAME_SIZE) {
+    FlushEvents();
+  }
+  auto &event = m_event_frame[m_event_frame_count];
+  if (m_event_frame_count++ == 0) {
+    auto stamp = m_in_report ? m_report_arrival : MonotonicNow();
+    event.time.tv_sec = stamp.tv_sec;
+    event.time.tv_usec = stamp.tv_nsec / 1000;
+  } else {
+    event.time = m_event_frame[0].time;
+  }
+  event.type = type;
+  event.code = code;
+  event.value = val;
+  if (syn_report) {
+    FlushEvents();
+  }
+}
+
+void G13_Device::FlushEvents() {
+  if (m_event_frame_count == 0) {
+    return;
+  }
+  if (m_uinput_fid < 0) {
+    // not created yet, or creating it failed, which has been logged
+    m_event_frame_count = 0;
+    return;
+  }
+  auto size = m_event_frame_count * sizeof(struct input_event);
+  auto written = write(m_uinput_fid, m_event_frame, size);
+  if (written != static_cast<ssize_t>(size)) {
+    G13_ERR("Could not write " << m_event_frame_count
+                               << " events to uinput: " << strerror(errno));
+  }
+  m_events_written += m_event_frame_count;
+  m_event_frame_count = 0;
+}
+
+/*! (re)creates the uinput device with the codes of the actions made so far
+ *
+ * Capabilities are fixed once a uinput device exists, so new codes mean a new
+ * device. CreateUinput() runs from a timer armed by UseAction(), so that a
+ * whole configuration file or pipe read is taken in one go.
+ */
+void G13_Device::CreateUinput() {
+  if (m_uinput_fid >= 0) {
+    FlushEvents();
+    ioctl(m_uinput_fid, UI_DEV_DESTROY);
+    close(m_uinput_fid);
+  }
+  m_uinput_fid = G13CreateUinput(this);
+  G13_DBG("uinput device created with " << m_input_keys.count() << " keys and "
+                                        << m_input_rels.count() << " axes");
+}
+
+G13_ActionPtr G13_Device::MakeAction(std::string_view action,
+                                     Helper::Arena &arena) {
+  return UseAction(G13_Action::Make(action, arena));
+}
+
+G13_ActionPtr G13_Device::MakeAction(std::string_view action) {
+  Helper::Arena arena(G13_BOUND_ARENA_SIZE);
+  auto made = G13_Action::Make(action, arena);
+  m_bound_arenas.emplace(made, std::move(arena));
+  return UseAction(made);
+}
+
+/*! lets go of an action bound at runtime once it has been replaced
+ *
+ * It may be the action running right now, e.g. a key bound to a bind command
+ * rebinding itself, or one ParseKeys() has still to run for a later key of
+ * the report. Its arena is only freed when the next report or input is
+ * handled, when none can be.
+ */
+void G13_Device::Unbind(G13_ActionPtr action) {
+  auto bound = m_bound_arenas.find(action);
+  if (bound != m_bound_arenas.end()) {
+    KeepBindings(action);
+    m_unbound_arenas.push_back(std::move(bound->second));
+    m_bound_arenas.erase(bound);
+  }
 }
 
-void G13_Device::OutputPipeWrite(const std::string &out) const {
-  write(m_output_pipe_fid, out.c_str(), out.size());
+/*! makes again the bindings to the actions a command action made with itself
+ *
+ * A key bound to e.g. `!bind G2 KEY_B` binds G2 to an action made along with
+ * its own, in the same arena, so that a key press makes nothing. Before that
+ * arena goes away, each binding to such an action is given one of its own.
+ */
+void G13_Device::KeepBindings(G13_ActionPtr action) {
+  bool current = false;
+  for (auto command = action->command(); command && command->compiled.args.made;
+       command = command->compiled.args.made->command()) {
+    auto nested = command->compiled.args.made;
+    for (auto &[name, profile] : m_profiles) {
+      for (G13_KEY_INDEX key = 0; key < G13_KEY_INDEX(G13_NUM_KEYS); key++) {
+        if (profile->own_action(key) == nested) {
+          profile->set_action(key, MakeAction(command->compiled.args.action));
+          current |= profile == m_currentProfile;
+        }
+      }
+    }
+    for (auto &zone : m_stick.zones()) {
+      if (zone.action() == nested) {
+        m_stick.zone(zone.name())
+            ->set_action(MakeAction(command->compiled.args.action));
+      }
+    }
+  }
+  if (current) {
+    m_currentProfile->Flatten(m_key_table);
+  }
+}
+
+G13_ActionPtr G13_Device::UseAction(G13_ActionPtr action) {
+  auto keys = action->keys();
+  if (!keys) {
+    return action;
+  }
+  bool added = false;
+  for (size_t i = 0; i < keys->down_count + keys->up_count; i++) {
+    auto code = keys->keys[i];
+    if (code & G13_REL_FLAG) {
+      code &= ~(G13_REL_FLAG | G13_REL_NEGATIVE);
+      added |= !m_input_rels[code];
+      m_input_rels.set(code);
+    } else {
+      added |= !m_input_keys[code];
+      m_input_keys.set(code);
+    }
+  }
+  if (added && m_uinput_timer >= 0) {
+    G13_Reactor::ArmTimer(m_uinput_timer, 0);
+  }
+  return action;
+}
+
+void G13_Device::OutputPipeWrite(const char *out, size_t size) const {
+  write(m_output_pipe_fid, out, size);
 }
 
 void G13_Device::SetModeLeds(int leds) {
   unsigned char usb_data[] = {5, 0, 0, 0, 0};
   usb_data[1] = leds;
-  int error = libusb_control_transfer(
-      handle, LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, 9, 0x305,
-      0, usb_data, 5, 1000);
-  if (error != 5) {
-    G13_ERR("Problem setting mode LEDs: " + DescribeLibusbErrorCode(error));
-    return;
-  }
+  QueueControl(CONTROL_MODE_LEDS, usb_data);
 }
 
 void G13_Device::SetKeyColor(int red, int green, int blue) {
-  int error;
   unsigned char usb_data[] = {5, 0, 0, 0, 0};
   usb_data[1] = red;
   usb_data[2] = green;
   usb_data[3] = blue;
+  QueueControl(CONTROL_KEY_COLOR, usb_data);
+}
 
-  error = libusb_control_transfer(
-      handle, LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, 9, 0x307,
-      0, usb_data, 5, 1000);
-  if (error != 5) {
-    G13_ERR("Problem changing color: " + DescribeLibusbErrorCode(error));
+/*! sends a control report without waiting for it
+ *
+ * Each kind of report has one slot. A request matching what the device
+ * already shows is skipped, one arriving while the slot's transfer is in
+ * flight replaces whatever was queued behind it, so an animated backlight
+ * can never pile up transfers or hold up key handling.
+ */
+void G13_Device::QueueControl(int slot, const unsigned char *data) {
+  auto &control = m_control[slot];
+  memcpy(control.wanted, data, G13_CONTROL_SIZE);
+  if (control.in_flight) {
+    if (control.queued) {
+      m_control_superseded++;
+    }
+    auto sending = control.transfer->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+    control.queued = memcmp(sending, data, G13_CONTROL_SIZE) != 0;
+    return;
+  }
+  if (control.have_applied &&
+      memcmp(control.applied, data, G13_CONTROL_SIZE) == 0) {
+    m_control_skipped++;
     return;
   }
+  SubmitControl(slot);
+}
+
+bool G13_Device::SubmitControl(int slot) {
+  static const uint16_t reports[CONTROL_SLOTS] = {0x305, 0x307};
+  auto &control = m_control[slot];
+  // without a handle the report stays wanted, Resume() sends it
+  if (m_closing || !handle) {
+    return false;
+  }
+  if (!control.transfer) {
+    control.transfer = libusb_alloc_transfer(0);
+    if (!control.transfer) {
+      G13_ERR("Could not allocate control transfer");
+      return false;
+    }
+    control.report = reports[slot];
+    auto buffer = static_cast<unsigned char *>(
+        malloc(LIBUSB_CONTROL_SETUP_SIZE + G13_CONTROL_SIZE));
+    libusb_fill_control_setup(
+        buffer, LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, 9,
+        control.report, 0, G13_CONTROL_SIZE);
+    libusb_fill_control_transfer(control.transfer, handle, buffer,
+                                 ControlTransferCallback, this, 1000);
+    control.transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+  }
+  memcpy(control.transfer->buffer + LIBUSB_CONTROL_SETUP_SIZE, control.wanted,
+         G13_CONTROL_SIZE);
+  int error = libusb_submit_transfer(control.transfer);
+  if (error != LIBUSB_SUCCESS) {
+    G13_ERR("Problem sending control report 0x"
+            << std::hex << control.report << std::dec << ": "
+            << DescribeLibusbErrorCode(error));
+    return false;
+  }
+  control.in_flight = true;
+  m_transfers_in_flight++;
+  return true;
+}
+
+void LIBUSB_CALL
+G13_Device::ControlTransferCallback(libusb_transfer *transfer) {
+  auto g13 = static_cast<G13_Device *>(transfer->user_data);
+  g13->m_transfers_in_flight--;
+
+  int slot = 0;
+  while (g13->m_control[slot].transfer != transfer) {
+    slot++;
+  }
+  auto &control = g13->m_control[slot];
+  control.in_flight = false;
+
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+      transfer->actual_length == G13_CONTROL_SIZE) {
+    memcpy(control.applied, transfer->buffer + LIBUSB_CONTROL_SETUP_SIZE,
+           G13_CONTROL_SIZE);
+    control.have_applied = true;
+  } else {
+    // whatever the device shows now, it is not known to be what we asked for
+    control.have_applied = false;
+    if (transfer->status != LIBUSB_TRANSFER_CANCELLED &&
+        transfer->status != LIBUSB_TRANSFER_NO_DEVICE) {
+      G13_ERR("Problem sending control report 0x"
+              << std::hex << control.report << std::dec
+              << ": transfer status " << transfer->status);
+    }
+  }
+
+  if (control.queued) {
+    control.queued = false;
+    g13->QueueControl(slot, control.wanted);
+  }
 }
 
 /*! reads and processes key state report from G13
@@ -173,6 +405,7 @@ int G13_Device::ReadKeypresses() {
   int error =
       libusb_interrupt_transfer(handle, LIBUSB_ENDPOINT_IN | G13_KEY_ENDPOINT,
                                 buffer, G13_REPORT_SIZE, &size, 100);
+  auto arrival = MonotonicNow();
 
   if (error && error != LIBUSB_ERROR_TIMEOUT) {
     G13_ERR("Error while reading keys: " << DescribeLibusbErrorCode(error));
@@ -182,79 +415,469 @@ int G13_Device::ReadKeypresses() {
     }
   }
   if (size == G13_REPORT_SIZE) {
-    parse_joystick(buffer);
-    m_currentProfile->ParseKeys(buffer);
-    SendEvent(EV_SYN, SYN_REPORT, 0);
+    ProcessKeyReport(buffer, arrival);
   }
   return 0;
 }
 
-void G13_Device::ReadConfigFile(const std::string &filename) {
-  std::ifstream s(filename);
+/*! turns one report into uinput events
+ *
+ * arrival is the CLOCK_MONOTONIC time the report was taken off the bus, it
+ * stamps every event made from the report and is the start of the latency
+ * reported by dump.
+ */
+void G13_Device::ProcessKeyReport(unsigned char *buffer,
+                                  const struct timespec &arrival) {
+  m_unbound_arenas.clear();
+  m_report_arrival = arrival;
+  m_in_report = true;
+  auto events_written = m_events_written;
+
+  parse_joystick(buffer);
+  m_key_table.ParseKeys(*this, buffer);
+  SendEvent(EV_SYN, SYN_REPORT, 0);
+
+  m_in_report = false;
+  if (m_events_written != events_written) {
+    auto now = MonotonicNow();
+    unsigned long latency = (now.tv_sec - arrival.tv_sec) * 1000000 +
+                            (now.tv_nsec - arrival.tv_nsec) / 1000;
+    m_latency_samples++;
+    m_latency_total += latency;
+    m_latency_max = std::max(m_latency_max, latency);
+  }
+}
 
-  G13_OUT("reading configuration from " << filename);
-  if (s.fail()) G13_LOG(log4cpp::Priority::ERROR << strerror(errno));
-  else while (s.good()) {
-    // grab a line
-    char buf[1024];
-    buf[0] = 0;
-    buf[sizeof(buf) - 1] = 0;
-    s.getline(buf, sizeof(buf) - 1);
+/*! keeps a ring of asynchronous interrupt transfers submitted on the key
+ * endpoint
+ *
+ * Reports are then processed from KeyTransferCallback() as soon as libusb
+ * sees them arrive instead of whenever the main loop gets around to polling
+ * this device. With more than one transfer in the ring reports arriving while
+ * the loop is busy queue up in the transfers behind the one being handled
+ * instead of being lost. The ring size is taken from the key_transfers config
+ * value.
+ *
+ * Returns false if no transfer could be submitted, in which case the device
+ * falls back to synchronous ReadKeypresses().
+ */
+bool G13_Device::StartKeyTransfer() {
+  int count = G13_DEFAULT_KEY_TRANSFERS;
+  std::string configured =
+      G13_Manager::Instance()->getStringConfigValue("key_transfers");
+  if (!configured.empty()) {
+    count = std::max(1, std::min(atoi(configured.c_str()),
+                                 G13_MAX_KEY_TRANSFERS));
+  }
 
-    // strip comment
-    char *comment = strchr(buf, '#');
-    if (comment) {
-      comment--;
-      while (comment > buf && isspace(*comment))
-        comment--;
-      comment++;
-      *comment = 0;
+  while (m_key_transfers.size() < static_cast<size_t>(count)) {
+    auto transfer = libusb_alloc_transfer(0);
+    if (!transfer) {
+      G13_ERR("Could not allocate key transfer");
+      break;
     }
+    auto buffer = static_cast<unsigned char *>(malloc(G13_REPORT_SIZE));
+    libusb_fill_interrupt_transfer(
+        transfer, handle, LIBUSB_ENDPOINT_IN | G13_KEY_ENDPOINT, buffer,
+        G13_REPORT_SIZE, KeyTransferCallback, this, 0);
+    transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    m_key_transfers.push_back(transfer);
+  }
 
-    // send it
-    if (buf[0]) {
-      G13_OUT("  cfg: " << buf);
-      Command(buf);
+  for (auto transfer : m_key_transfers) {
+    if (!SubmitKeyTransfer(transfer)) {
+      break;
     }
   }
+  m_async_keys = m_key_transfers_in_flight > 0;
+  if (!m_async_keys) {
+    G13_OUT("Falling back to synchronous key reads");
+  } else {
+    G13_DBG(m_key_transfers_in_flight << " key transfers submitted");
+  }
+  return m_async_keys;
 }
 
-void G13_Device::ReadCommandsFromPipe() {
-  fd_set set;
-  FD_ZERO(&set);
-  FD_SET(m_input_pipe_fid, &set);
-  struct timeval tv {};
-  tv.tv_sec = 0;
-  tv.tv_usec = 0;
-  int ret = select(m_input_pipe_fid + 1, &set, nullptr, nullptr, &tv);
-  if (ret > 0) {
-    unsigned char buf[1024 * 1024];
-    memset(buf, 0, 1024 * 1024);
-    ret = read(m_input_pipe_fid, buf, 1024 * 1024);
-    G13_LOG(log4cpp::Priority::DEBUG << "read " << ret << " characters");
-
-    if (ret ==
-        960) { // TODO probably image, for now, don't test, just assume image
-      lcd().Image(buf, ret);
+bool G13_Device::SubmitKeyTransfer(libusb_transfer *transfer) {
+  if (m_closing) {
+    return false;
+  }
+  int error = libusb_submit_transfer(transfer);
+  if (error != LIBUSB_SUCCESS) {
+    G13_ERR("Error submitting key transfer: "
+            << DescribeLibusbErrorCode(error));
+    return false;
+  }
+  m_transfers_in_flight++;
+  m_key_transfers_in_flight++;
+  return true;
+}
+
+/*! handles one completed key transfer
+ *
+ * The report is copied out and the transfer handed straight back to libusb
+ * before the report is processed, so the ring stays as full as possible.
+ * Transfers that end in an error are counted in failed_transfers. Reports
+ * carry no sequence number, so a lost one cannot be told from the reports
+ * themselves. Instead ring_drained counts the times a transfer came back with
+ * no other in flight: until it is resubmitted the G13 has nowhere to send its
+ * reports, and changes it makes meanwhile may be merged into one.
+ */
+void LIBUSB_CALL G13_Device::KeyTransferCallback(libusb_transfer *transfer) {
+  auto arrival = MonotonicNow();
+  auto g13 = static_cast<G13_Device *>(transfer->user_data);
+  g13->m_transfers_in_flight--;
+  if (--g13->m_key_transfers_in_flight == 0 && !g13->m_closing) {
+    g13->m_ring_drained++;
+  }
+
+  unsigned char report[G13_REPORT_SIZE];
+  bool have_report = false;
+
+  switch (transfer->status) {
+  case LIBUSB_TRANSFER_COMPLETED:
+    if (transfer->actual_length == G13_REPORT_SIZE) {
+      memcpy(report, transfer->buffer, G13_REPORT_SIZE);
+      have_report = true;
+    }
+    break;
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    break;
+  case LIBUSB_TRANSFER_CANCELLED:
+    return;
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    G13_DBG("Key transfer stopped, device is gone");
+    return;
+  default:
+    g13->m_failed_transfers++;
+    G13_ERR("Error while reading keys: transfer status " << transfer->status);
+    break;
+  }
+
+  if (!g13->SubmitKeyTransfer(transfer) && !g13->m_closing &&
+      g13->m_key_transfers_in_flight == 0) {
+    // keep the device usable even if libusb refuses to take the ring back
+    g13->m_async_keys = false;
+  }
+
+  if (have_report) {
+    g13->m_key_reports++;
+    g13->ProcessKeyReport(report, arrival);
+  }
+}
+
+/*! stops resubmission and cancels every transfer still owned by libusb
+ *
+ * The device must not be deleted until TransfersPending() is false, the
+ * cancelled transfers still call back into it.
+ */
+void G13_Device::CancelTransfers() {
+  m_closing = true;
+  if (m_lcd_in_flight) {
+    libusb_cancel_transfer(m_lcd_transfer);
+  }
+  for (auto &control : m_control) {
+    if (control.in_flight) {
+      libusb_cancel_transfer(control.transfer);
+    }
+  }
+  if (m_key_transfers_in_flight > 0) {
+    for (auto transfer : m_key_transfers) {
+      // not found errors for transfers that are not submitted are harmless
+      libusb_cancel_transfer(transfer);
+    }
+  }
+}
+
+/*! runs the commands of a configuration, which were parsed when it was
+ * loaded, see G13_Config
+ *
+ * Profiles recorded by the configuration are only made when they are
+ * selected, by the configuration itself or later on, see Profile(). Those
+ * the device has already get their recorded bindings right away.
+ */
+void G13_Device::ApplyConfig(const std::shared_ptr<const G13_Config> &config) {
+  m_configs.push_back(config);
+  auto &commands = config->commands();
+  size_t failed = 0;
+  for (size_t i = 0; i < commands.size(); i++) {
+    if (!config->recorded(i)) {
+      failed += !RunCommand(commands[i]);
+    } else if (commands[i].args.made) {
+      // uinput has to be able to send what any profile may
+      UseAction(commands[i].args.made);
+    }
+  }
+  for (auto &profile : m_profiles) {
+    if (auto record = config->profile(profile.first)) {
+      for (auto &binding : record->bindings) {
+        profile.second->set_action(binding.first, binding.second);
+      }
+    }
+  }
+  SwitchToProfile(config->selected().empty() ? m_currentProfile->name()
+                                             : config->selected());
+  G13_OUT("applied " << commands.size() - failed << " of " << commands.size()
+                     << " commands from " << config->filename());
+}
+
+/*! moves the device from one configuration to the next, changing only what
+ * differs between them
+ *
+ * Lines the old configuration did not have are run, in order, leaving out
+ * bindings and profile lines. Bindings are then compared target by target,
+ * see G13_Config::Bindings(), and only changed where the device still has
+ * what the old configuration bound, so bindings made at runtime stay. A
+ * binding the new configuration drops is removed. Keys held down across the
+ * change are let go of through their old action and pressed again through
+ * their new one. The uinput device is only made again if a binding sends
+ * codes it could not.
+ *
+ * Runs from the event loop, so always between two key reports.
+ */
+void G13_Device::ReloadConfig(
+    const std::shared_ptr<const G13_Config> &old_config,
+    const std::shared_ptr<const G13_Config> &new_config) {
+  auto applied = std::find(m_configs.begin(), m_configs.end(), old_config);
+  if (applied == m_configs.end()) {
+    return;
+  }
+
+  auto profile = FindCommand("profile");
+  auto &old_commands = old_config->commands();
+  std::vector<bool> matched(old_commands.size());
+  size_t ran = 0;
+  for (auto &command : new_config->commands()) {
+    if (command.args.action || command.run == profile) {
+      continue;
+    }
+    size_t i = 0;
+    while (i < old_commands.size() &&
+           (matched[i] || !G13_Config::Same(old_commands[i], command))) {
+      i++;
+    }
+    if (i < old_commands.size()) {
+      matched[i] = true;
     } else {
-      std::string buffer = reinterpret_cast<const char *>(buf);
-      auto lines = Helper::split<std::vector<std::string>>(
-          buffer, "\n\r", Helper::split::no_empties);
-
-      for (auto &cmd : lines) {
-        auto command_comment = Helper::split<std::vector<std::string>>(
-            cmd, "#", Helper::split::no_empties);
-
-        if (!command_comment.empty() && command_comment[0] != std::string("")) {
-          while (isspace(command_comment[0].back()))
-            command_comment[0].pop_back();
-          if (command_comment[0] != std::string("")) {
-            G13_OUT("command: " << command_comment[0]);
-            Command(command_comment[0].c_str());
-          }
-        }
+      RunCommand(command);
+      ran++;
+    }
+  }
+
+  auto old_bindings = old_config->Bindings();
+  auto new_bindings = new_config->Bindings();
+  std::map<G13_ActionPtr, G13_ActionPtr> renewed; // same line, old to new
+  size_t changed = 0;
+  auto rebind = [&](const G13_Config::BindingTarget &target,
+                    const G13_Command *was, const G13_Command *now) {
+    G13_ActionPtr expected = was ? was->args.made : nullptr;
+    bool same = was && now && G13_Config::Same(*was, *now);
+    std::string name(target.second);
+    if (target.first.empty()) {
+      auto zone = m_stick.zone(name);
+      if (!zone || zone->action() != expected) {
+        return;
+      }
+      if (!same) {
+        zone->release(*this);
+      }
+      zone->set_action(now ? UseAction(now->args.made) : nullptr);
+    } else {
+      // profiles not made yet are made from the new configuration
+      auto made = m_profiles.find(target.first);
+      if (made == m_profiles.end()) {
+        return;
+      }
+      auto key = G13_Profile::FindKey(name);
+      auto &bound = made->second;
+      if (bound->own_action(key) != expected) {
+        return;
+      }
+      if (now) {
+        bound->set_action(key, UseAction(now->args.made));
+      } else {
+        bound->remove_action(key);
       }
     }
+    if (same) {
+      renewed[expected] = now->args.made;
+    } else {
+      changed++;
+    }
+  };
+  auto was = old_bindings.begin();
+  auto now = new_bindings.begin();
+  while (was != old_bindings.end() || now != new_bindings.end()) {
+    if (now == new_bindings.end() ||
+        (was != old_bindings.end() && was->first < now->first)) {
+      rebind(was->first, was->second, nullptr);
+      ++was;
+    } else if (was == old_bindings.end() || now->first < was->first) {
+      rebind(now->first, nullptr, now->second);
+      ++now;
+    } else {
+      rebind(now->first, was->second, now->second);
+      ++was;
+      ++now;
+    }
+  }
+
+  for (auto &command : new_config->commands()) {
+    if (command.args.made) {
+      UseAction(command.args.made);
+    }
+  }
+
+  for (auto &command : old_commands) {
+    if (command.args.made) {
+      KeepBindings(command.args.made);
+    }
+  }
+
+  G13_KeyTable before = m_key_table;
+  m_currentProfile->Flatten(m_key_table);
+  for (uint64_t held = m_key_state; held; held &= held - 1) {
+    int key = __builtin_ctzll(held);
+    auto old_action = before.action(key);
+    auto new_action = m_key_table.action(key);
+    auto i = renewed.find(old_action);
+    if (old_action == new_action ||
+        (i != renewed.end() && i->second == new_action)) {
+      continue;
+    }
+    if (old_action) {
+      old_action->act(*this, false);
+    }
+    if (new_action) {
+      new_action->act(*this, true);
+    }
+  }
+  SendEvent(EV_SYN, SYN_REPORT, 0);
+
+  // nothing points into the old configuration any more
+  *applied = new_config;
+  G13_OUT("reloaded " << new_config->filename() << ": ran " << ran
+                      << " commands, changed " << changed << " bindings");
+}
+
+/*! called by the reactor whenever the input pipe is readable
+ *
+ * Commands are parsed in place from m_input_buffer, a command split across
+ * two reads is simply completed by the second one.
+ */
+void G13_Device::ReadCommandsFromPipe() {
+  bool was_empty = m_input_buffer.size() == 0;
+  auto ret = m_input_buffer.ReadFrom(m_input_pipe_fid);
+  if (ret <= 0) {
+    return;
+  }
+  G13_DBG("read " << ret << " characters");
+
+  if (!m_input_framed && was_empty && ret == G13_LCD_BUFFER_SIZE &&
+      memcmp(m_input_buffer.data(), G13_FRAME_MAGIC,
+             sizeof(G13_FRAME_MAGIC)) != 0) {
+    // TODO probably image, for now, don't test, just assume image
+    // (clients that have sent a frame get no more guessing, an image may
+    // well start with a 0 byte, so only the frame magic tells them apart)
+    lcd().Image((unsigned char *)m_input_buffer.data(), ret);
+    m_input_buffer.Clear();
+    return;
+  }
+
+  ProcessInput(m_input_buffer);
+}
+
+/*! executes everything complete in input
+ *
+ * Input is a mix of newline terminated text commands and frames (see
+ * G13_FRAME_MAGIC). Anything incomplete is left in the buffer for the next
+ * call.
+ */
+void G13_Device::ProcessInput(Helper::LineBuffer &input) {
+  m_unbound_arenas.clear();
+  while (input.size() > 0) {
+    if (input.data()[0] != 0) {
+      char *line = input.NextLine();
+      if (!line) {
+        return;
+      }
+      ExecuteCommandLine(line);
+      continue;
+    }
+
+    if (input.size() < G13_FRAME_HEADER_SIZE) {
+      return;
+    }
+    auto header = reinterpret_cast<const unsigned char *>(input.data());
+    if (memcmp(header, G13_FRAME_MAGIC, sizeof(G13_FRAME_MAGIC)) != 0) {
+      // what follows the next newline may still be good commands
+      auto newline = static_cast<const char *>(
+          memchr(input.data(), '\n', input.size()));
+      size_t bad = newline ? newline - input.data() + 1 : input.size();
+      G13_ERR("bad frame header, dropping " << bad << " bytes");
+      input.Consume(bad);
+      continue;
+    }
+    size_t length = header[6] | (header[7] << 8u);
+    if (length > G13_FRAME_MAX_PAYLOAD) {
+      G13_ERR("frame of " << length << " bytes is too big, dropping input");
+      input.Clear();
+      return;
+    }
+    if (input.size() < G13_FRAME_HEADER_SIZE + length) {
+      return;
+    }
+    m_input_framed = true;
+    ProcessFrame(header[4], header + G13_FRAME_HEADER_SIZE, length);
+    input.Consume(G13_FRAME_HEADER_SIZE + length);
+  }
+}
+
+void G13_Device::ProcessFrame(int type, const unsigned char *payload,
+                              size_t length) {
+  switch (type) {
+  case G13_FRAME_TEXT: {
+    std::string text(reinterpret_cast<const char *>(payload), length);
+    char *line = &text[0];
+    while (line) {
+      char *next = strpbrk(line, "\n\r");
+      if (next) {
+        *next++ = 0;
+      }
+      ExecuteCommandLine(line);
+      line = next;
+    }
+    break;
+  }
+  case G13_FRAME_IMAGE:
+    lcd().Image(const_cast<unsigned char *>(payload), length);
+    break;
+  case G13_FRAME_REGION: {
+    size_t offset = length >= 2 ? payload[0] | (payload[1] << 8u) : 0;
+    if (length < 2 || offset + length - 2 > G13_LCD_BUF_SIZE) {
+      G13_ERR("bad LCD region frame, " << length << " bytes at " << offset);
+      break;
+    }
+    memcpy(lcd().image_buf + offset, payload + 2, length - 2);
+    lcd().image_send();
+    break;
+  }
+  default:
+    G13_ERR("unknown frame type " << type);
+    break;
+  }
+}
+
+void G13_Device::ExecuteCommandLine(char *line) {
+  char *comment = strchr(line, '#');
+  char *end = comment ? comment : line + strlen(line);
+  while (end > line && isspace(end[-1])) {
+    end--;
+  }
+  *end = 0;
+  if (line[0]) {
+    G13_OUT("command: " << line);
+    Command(line);
   }
 }
 
@@ -266,42 +889,103 @@ FontPtr G13_Device::SwitchToFont(const std::string &name) {
   return rv;
 }
 
-void G13_Device::SwitchToProfile(const std::string &name) {
+void G13_Device::SwitchToProfile(std::string_view name) {
   m_currentProfile = Profile(name);
+  m_currentProfile->Flatten(m_key_table);
+  auto used = m_profile_used.find(name);
+  if (used != m_profile_used.end()) {
+    used->second = ++m_profile_clock;
+  }
+  EvictProfiles();
 }
 
-ProfilePtr G13_Device::Profile(const std::string &name) {
-  ProfilePtr rv = m_profiles[name];
-  if (!rv) {
-    rv = std::make_shared<G13_Profile>(*m_currentProfile, name);
-    m_profiles[name] = rv;
+/*! the profile called name, made from the ProfileRecord of the latest
+ * configuration that has one, or else created on top of the current profile
+ */
+ProfilePtr G13_Device::Profile(std::string_view name) {
+  auto i = m_profiles.find(name);
+  if (i != m_profiles.end()) {
+    return i->second;
   }
+  for (auto config = m_configs.rbegin(); config != m_configs.rend(); ++config) {
+    if (auto record = (*config)->profile(name)) {
+      return MakeProfile(name, *record);
+    }
+  }
+  auto rv =
+      std::make_shared<G13_Profile>(*this, std::string(name), m_currentProfile);
+  m_profiles.emplace(name, rv);
   return rv;
 }
 
-G13_ActionPtr G13_Device::MakeAction(const std::string &action) {
-  if (action.empty()) {
-    throw G13_CommandException("empty action string");
+ProfilePtr G13_Device::MakeProfile(std::string_view name,
+                                   const G13_Config::ProfileRecord &record) {
+  // the parent was selected before, so it is recorded too or is "default"
+  auto rv = std::make_shared<G13_Profile>(*this, std::string(name),
+                                          Profile(record.parent));
+  for (auto &binding : record.bindings) {
+    rv->set_action(binding.first, binding.second);
   }
-  if (action[0] == '>') {
-    return G13_ActionPtr(new G13_Action_PipeOut(*this, &action[1]));
-  } else if (action[0] == '!') {
-    return G13_ActionPtr(new G13_Action_Command(*this, &action[1]));
-  } else {
-    return G13_ActionPtr(new G13_Action_Keys(*this, action));
+  m_profiles.emplace(name, rv);
+  m_profile_used.emplace(name, ++m_profile_clock);
+  G13_DBG("made profile " << name << " with " << record.bindings.size()
+                          << " bindings");
+  return rv;
+}
+
+/*! drops the profiles made from a ProfileRecord that were selected least
+ * recently, until no more than the profile_cache config value are left
+ *
+ * Only profiles nothing else holds on to go, so neither the current one nor
+ * the parent of one still made. They are made again when next selected.
+ */
+void G13_Device::EvictProfiles() {
+  size_t limit = G13_PROFILE_CACHE;
+  std::string configured =
+      G13_Manager::Instance()->getStringConfigValue("profile_cache");
+  if (!configured.empty()) {
+    limit = std::max(0L, atol(configured.c_str()));
+  }
+  while (m_profile_used.size() > limit) {
+    auto oldest = m_profile_used.end();
+    for (auto i = m_profile_used.begin(); i != m_profile_used.end(); ++i) {
+      if (m_profiles.find(i->first)->second.use_count() == 1 &&
+          (oldest == m_profile_used.end() || i->second < oldest->second)) {
+        oldest = i;
+      }
+    }
+    if (oldest == m_profile_used.end()) {
+      return;
+    }
+    G13_DBG("evicting profile " << oldest->first);
+    m_profiles.erase(oldest->first);
+    m_profile_used.erase(oldest);
   }
-  // UNREACHABLE: throw G13_CommandException("can't create action for " +
-  // action);
 }
 
 // *************************************************************************
 
 void G13_Device::Dump(std::ostream &o, int detail) {
-  o << "G13 id=" << id_within_manager() << std::endl;
+  o << "G13 id=" << id_within_manager() << " port=" << m_port_path
+    << std::endl;
   o << "   input_pipe_name=" << Helper::repr(m_input_pipe_name) << std::endl;
   o << "   output_pipe_name=" << Helper::repr(m_output_pipe_name) << std::endl;
   o << "   current_profile=" << m_currentProfile->name() << std::endl;
   o << "   current_font=" << m_currentFont->name() << std::endl;
+  o << "   profiles=" << m_profiles.size()
+    << " evictable=" << m_profile_used.size() << std::endl;
+  o << "   key_transfers=" << m_key_transfers_in_flight << "/"
+    << m_key_transfers.size() << " key_reports=" << m_key_reports
+    << " failed_transfers=" << m_failed_transfers
+    << " ring_drained=" << m_ring_drained << std::endl;
+  o << "   lcd_frames=" << m_lcd_frames
+    << " lcd_frames_replaced=" << m_lcd_frames_replaced << std::endl;
+  o << "   control_skipped=" << m_control_skipped
+    << " control_superseded=" << m_control_superseded << std::endl;
+  if (m_latency_samples) {
+    o << "   report_latency avg=" << m_latency_total / m_latency_samples
+      << "us max=" << m_latency_max << "us" << std::endl;
+  }
 
   if (detail > 0) {
     o << "STICK" << std::endl;
@@ -316,190 +1000,323 @@ void G13_Device::Dump(std::ostream &o, int detail) {
   }
 }
 
-struct commandAdder {
-  commandAdder(G13_Device::CommandFunctionTable &t, const char *name)
-      : _t(t), _name(name) {}
+G13_Device::CommandTable G13_Device::_command_table;
 
-  commandAdder(G13_Device::CommandFunctionTable &t, const char *name,
-               G13_Device::COMMAND_FUNCTION f)
+struct commandAdder {
+  commandAdder(G13_Device::CommandTable &t, const char *name, COMMAND_PARSE p,
+               COMMAND_RUN r)
       : _t(t), _name(name) {
-    _t[_name] = std::move(f);
+    _t[_name] = {p, r};
   }
 
-  G13_Device::CommandFunctionTable &_t;
+  G13_Device::CommandTable &_t;
   std::string _name;
-
-  commandAdder &operator+=(G13_Device::COMMAND_FUNCTION f) {
-    _t[_name] = std::move(f);
-    return *this;
-  };
 };
 
-void G13_Device::InitCommands() {
-  using Helper::advance_ws;
-  // const char *remainder;
-
-  commandAdder add_out(_command_table, "out", [this](const char *remainder) {
-    lcd().WriteString(remainder);
-  });
+// for commands without arguments
+static void parse_nothing(Helper::Tokenizer &, G13_CommandArgs &) {}
 
-  commandAdder add_pos(_command_table, "pos", [this](const char *remainder) {
-    int row, col;
-    if (sscanf(remainder, "%i %i", &row, &col) == 2) {
-      lcd().WritePos(row, col);
-    } else {
-      G13_ERR("bad pos : " << remainder);
-    }
-  });
-
-  commandAdder add_bind(_command_table, "bind", [this](const char *remainder) {
-    std::string keyname;
-    advance_ws(remainder, keyname);
-    std::string action = remainder;
-    try {
-      if (auto key = m_currentProfile->FindKey(keyname)) {
-        key->set_action(MakeAction(action));
-      } else if (auto stick_key = m_stick.zone(keyname)) {
-        stick_key->set_action(MakeAction(action));
-      } else {
-        G13_ERR("bind key " << keyname << " unknown");
-        return;
-      }
-      G13_LOG(log4cpp::Priority::DEBUG << "bind " << keyname << " [" << action
-                                       << "]");
-    } catch (const std::exception &ex) {
-      G13_ERR("bind " << keyname << " " << action << " failed : " << ex.what());
-    }
-  });
+// for commands taking the rest of the line as it is
+static void parse_rest(Helper::Tokenizer &tokens, G13_CommandArgs &args) {
+  args.rest = tokens.rest();
+}
 
-  commandAdder add_profile(
-      _command_table, "profile",
-      [this](const char *remainder) { SwitchToProfile(remainder); });
+/*! fills the command table
+ *
+ * Every command is split in a parse step, which only looks at the text and
+ * can be done once when a command is bound to a key, and a run step doing
+ * the work on a device.
+ */
+void G13_Device::InitCommands() {
+  using Helper::Tokenizer;
+
+  commandAdder add_out(_command_table, "out", parse_rest,
+                       [](G13_Device &g13, const G13_CommandArgs &args) {
+                         g13.lcd().WriteString(args.rest);
+                       });
+
+  commandAdder add_pos(
+      _command_table, "pos",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        if (!tokens.next(args.i[0]) || !tokens.next(args.i[1])) {
+          throw G13_CommandException("bad pos : " + std::string(args.rest));
+        }
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        g13.lcd().WritePos(args.i[0], args.i[1]);
+      });
 
-  commandAdder add_font(_command_table, "font", [this](const char *remainder) {
-    SwitchToFont(remainder);
-  });
+  commandAdder add_bind(
+      _command_table, "bind",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        args.word = tokens.next();
+        args.rest = tokens.rest();
+        args.action = args.rest;
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        std::string keyname(args.word);
+        std::string_view action = args.action;
+        try {
+          auto key = G13_Profile::FindKey(keyname);
+          if (key >= 0) {
+            auto bound = args.made ? g13.UseAction(args.made)
+                                   : g13.MakeAction(action);
+            auto old = g13.m_currentProfile->own_action(key);
+            g13.m_currentProfile->set_action(key, bound);
+            g13.m_key_table.set_action(key, bound);
+            // no longer what its record would make
+            g13.m_profile_used.erase(g13.m_currentProfile->name());
+            // after, as bound may have been made along with old
+            g13.Unbind(old);
+          } else if (auto stick_key = g13.m_stick.zone(keyname)) {
+            auto bound = args.made ? g13.UseAction(args.made)
+                                   : g13.MakeAction(action);
+            auto old = stick_key->action();
+            stick_key->set_action(bound);
+            g13.Unbind(old);
+          } else {
+            throw G13_CommandException("unknown key");
+          }
+          G13_DBG("bind " << keyname << " [" << action << "]");
+        } catch (const G13_CommandException &ex) {
+          throw G13_CommandException("bind " + keyname + " " +
+                                     std::string(action) +
+                                     " failed : " + ex.what());
+        }
+      });
 
-  commandAdder add_mod(_command_table, "mod", [this](const char *remainder) {
-    SetModeLeds(atoi(remainder));
-  });
+  commandAdder add_profile(_command_table, "profile", parse_rest,
+                           [](G13_Device &g13, const G13_CommandArgs &args) {
+                             g13.SwitchToProfile(args.rest);
+                           });
+
+  commandAdder add_font(_command_table, "font", parse_rest,
+                        [](G13_Device &g13, const G13_CommandArgs &args) {
+                          g13.SwitchToFont(args.rest);
+                        });
+
+  commandAdder add_mod(
+      _command_table, "mod",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        if (!tokens.next(args.i[0])) {
+          throw G13_CommandException("bad mod : " + std::string(args.rest));
+        }
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        g13.SetModeLeds(args.i[0]);
+      });
 
   commandAdder add_textmode(
       _command_table, "textmode",
-      [this](const char *remainder) { lcd().text_mode = atoi(remainder); });
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        if (!tokens.next(args.i[0])) {
+          throw G13_CommandException("bad textmode : " +
+                                     std::string(args.rest));
+        }
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        g13.lcd().text_mode = args.i[0];
+      });
 
-  commandAdder add_rgb(_command_table, "rgb", [this](const char *remainder) {
-    int red, green, blue;
-    if (sscanf(remainder, "%i %i %i", &red, &green, &blue) == 3) {
-      SetKeyColor(red, green, blue);
-    } else {
-      G13_ERR("rgb bad format: <" << remainder << ">");
-    }
-  });
+  commandAdder add_rgb(
+      _command_table, "rgb",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        if (!tokens.next(args.i[0]) || !tokens.next(args.i[1]) ||
+            !tokens.next(args.i[2])) {
+          throw G13_CommandException("rgb bad format: <" +
+                                     std::string(args.rest) + ">");
+        }
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        g13.SetKeyColor(args.i[0], args.i[1], args.i[2]);
+      });
 
   commandAdder add_stickmode(
-      _command_table, "stickmode", [this](const char *remainder) {
-        std::string mode = remainder;
-        // TODO: this could be part of a G13::Constants class I think
-        const std::set<std::string> modes = {"ABSOLUTE",  "RELATIVE",
-                                             "KEYS",      "CALCENTER",
-                                             "CALBOUNDS", "CALNORTH"};
-        int index = 0;
-        for (auto &test : modes) {
-          if (test == mode) {
-            m_stick.set_mode((G13::stick_mode_t)index);
+      _command_table, "stickmode",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        // in stick_mode_t order
+        static const std::string_view modes[] = {
+            "ABSOLUTE", "KEYS", "CALCENTER", "CALBOUNDS", "CALNORTH"};
+        auto mode = tokens.next();
+        for (size_t index = 0; index < sizeof(modes) / sizeof(*modes); index++) {
+          if (modes[index] == mode) {
+            args.i[0] = index;
             return;
           }
-          index++;
         }
-        G13_ERR("unknown stick mode : <" << mode << ">");
+        throw G13_CommandException("unknown stick mode : <" +
+                                   std::string(mode) + ">");
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        g13.m_stick.set_mode((G13::stick_mode_t)args.i[0]);
       });
 
+  enum { ZONE_ADD, ZONE_ACTION, ZONE_BOUNDS, ZONE_DEL };
   commandAdder add_stickzone(
-      _command_table, "stickzone", [this](const char *remainder) {
-        std::string operation, zonename;
-        advance_ws(remainder, operation);
-        advance_ws(remainder, zonename);
+      _command_table, "stickzone",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        auto operation = tokens.next();
+        args.word = tokens.next();
+        args.rest = tokens.rest();
         if (operation == "add") {
-          /* G13_StickZone* zone = */
-          m_stick.zone(zonename, true);
-        } else {
-          G13_StickZone *zone = m_stick.zone(zonename);
-          if (!zone) {
-            throw G13_CommandException("unknown stick zone");
-          }
-          if (operation == "action") {
-            zone->set_action(MakeAction(remainder));
-          } else if (operation == "bounds") {
-            double x1, y1, x2, y2;
-            if (sscanf(remainder, "%lf %lf %lf %lf", &x1, &y1, &x2, &y2) != 4) {
+          args.i[0] = ZONE_ADD;
+        } else if (operation == "action") {
+          args.i[0] = ZONE_ACTION;
+          args.action = args.rest;
+        } else if (operation == "bounds") {
+          args.i[0] = ZONE_BOUNDS;
+          for (auto &d : args.d) {
+            if (!tokens.next(d)) {
               throw G13_CommandException("bad bounds format");
             }
-            zone->set_bounds(G13_ZoneBounds(x1, y1, x2, y2));
-
-          } else if (operation == "del") {
-            m_stick.RemoveZone(*zone);
-          } else {
-            G13_ERR("unknown stickzone operation: <" << operation << ">");
           }
+        } else if (operation == "del") {
+          args.i[0] = ZONE_DEL;
+        } else {
+          throw G13_CommandException("unknown stickzone operation: <" +
+                                     std::string(operation) + ">");
+        }
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        std::string zonename(args.word);
+        if (args.i[0] == ZONE_ADD) {
+          g13.m_stick.zone(zonename, true);
+          return;
+        }
+        G13_StickZone *zone = g13.m_stick.zone(zonename);
+        if (!zone) {
+          throw G13_CommandException("unknown stick zone");
+        }
+        if (args.i[0] == ZONE_ACTION) {
+          auto bound = args.made ? g13.UseAction(args.made)
+                                 : g13.MakeAction(args.action);
+          auto old = zone->action();
+          zone->set_action(bound);
+          g13.Unbind(old);
+        } else if (args.i[0] == ZONE_BOUNDS) {
+          zone->set_bounds(
+              G13_ZoneBounds(args.d[0], args.d[1], args.d[2], args.d[3]));
+        } else {
+          g13.Unbind(zone->action());
+          g13.m_stick.RemoveZone(*zone);
         }
       });
 
-  commandAdder add_dump(_command_table, "dump", [this](const char *remainder) {
-    std::string target;
-    advance_ws(remainder, target);
-    if (target == "all") {
-      Dump(std::cout, 3);
-    } else if (target == "current") {
-      Dump(std::cout, 1);
-    } else if (target == "summary") {
-      Dump(std::cout, 0);
-    } else {
-      G13_ERR("unknown dump target: <" << target << ">");
-    }
-  });
+  commandAdder add_dump(
+      _command_table, "dump",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        auto target = tokens.next();
+        if (target == "all") {
+          args.i[0] = 3;
+        } else if (target == "current") {
+          args.i[0] = 1;
+        } else if (target == "summary") {
+          args.i[0] = 0;
+        } else {
+          throw G13_CommandException("unknown dump target: <" +
+                                     std::string(target) + ">");
+        }
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        g13.Dump(g13.CommandOutput(), args.i[0]);
+      });
 
-  commandAdder add_log_level(_command_table, "log_level",
-                             [this](const char *remainder) {
-                               std::string level;
-                               advance_ws(remainder, level);
-                               G13_Manager::Instance()->SetLogLevel(level);
-                             });
+  commandAdder add_log_level(
+      _command_table, "log_level",
+      [](Tokenizer &tokens, G13_CommandArgs &args) {
+        args.word = tokens.next();
+      },
+      [](G13_Device &g13, const G13_CommandArgs &args) {
+        G13_Manager::Instance()->SetLogLevel(std::string(args.word));
+      });
 
-  commandAdder add_refresh(
-      _command_table, "refresh",
-      [this](const char *remainder) { lcd().image_send(); });
+  commandAdder add_refresh(_command_table, "refresh", parse_nothing,
+                           [](G13_Device &g13, const G13_CommandArgs &args) {
+                             g13.lcd().image_send();
+                           });
 
-  commandAdder add_clear(_command_table, "clear",
-                         [this](const char *remainder) {
-                           lcd().image_clear();
-                           lcd().image_send();
+  commandAdder add_clear(_command_table, "clear", parse_nothing,
+                         [](G13_Device &g13, const G13_CommandArgs &args) {
+                           g13.lcd().image_clear();
+                           g13.lcd().image_send();
                          });
 }
 
-void G13_Device::Command(char const *str) {
-  const char *remainder = str;
+/*! resolves the handler of a command and parses its arguments
+ *
+ * Returns false for unknown commands and throws G13_CommandException for bad
+ * arguments. The compiled command points into str, which has to stay around
+ * for as long as the command is used.
+ */
+bool G13_Device::CompileCommand(const char *str, G13_Command &command) {
+  if (_command_table.empty()) {
+    InitCommands();
+  }
+  Helper::Tokenizer tokens(str);
+  auto cmd = tokens.next();
 
-  try {
-    using Helper::advance_ws;
+  auto i = _command_table.find(cmd);
+  if (i == _command_table.end()) {
+    return false;
+  }
+  command.args = G13_CommandArgs{};
+  command.args.rest = tokens.rest();
+  i->second.parse(tokens, command.args);
+  command.run = i->second.run;
+  return true;
+}
 
-    std::string cmd;
-    advance_ws(remainder, cmd);
+COMMAND_RUN G13_Device::FindCommand(std::string_view name) {
+  if (_command_table.empty()) {
+    InitCommands();
+  }
+  auto i = _command_table.find(name);
+  return i == _command_table.end() ? nullptr : i->second.run;
+}
 
-    auto i = _command_table.find(cmd);
-    if (i == _command_table.end()) {
-      G13_ERR("unknown command : " << cmd);
-    } else {
-      COMMAND_FUNCTION f = i->second;
-      f(remainder);
+/*! runs a compiled command, returns false if it failed
+ *
+ * Failures are logged, and also reported to CommandOutput() when that has
+ * been redirected to a control client.
+ */
+bool G13_Device::RunCommand(const G13_Command &command) {
+  try {
+    command.run(*this, command.args);
+    return true;
+  } catch (const std::exception &ex) {
+    CommandFailed(std::string("command failed : ") + ex.what());
+    return false;
+  }
+}
+
+/*! executes one command, returns false if it failed
+ */
+bool G13_Device::Command(char const *str) {
+  G13_Command command{};
+  try {
+    if (!CompileCommand(str, command)) {
+      std::string cmd(str, strcspn(str, " "));
+      CommandFailed("unknown command : " + cmd);
+      return false;
     }
   } catch (const std::exception &ex) {
-    G13_ERR("command failed : " << ex.what());
+    CommandFailed(std::string("command failed : ") + ex.what());
+    return false;
+  }
+  return RunCommand(command);
+}
+
+void G13_Device::CommandFailed(const std::string &error) {
+  m_failed_commands++;
+  G13_ERR(error);
+  if (m_command_output) {
+    *m_command_output << "error: " << error << std::endl;
   }
 }
 
 void G13_Device::RegisterContext(libusb_context *libusbContext) {
   m_ctx = libusbContext;
+  m_registered = true;
 
   int leds = 0;
   int red = 0;
@@ -510,27 +1327,141 @@ void G13_Device::RegisterContext(libusb_context *libusbContext) {
   SetModeLeds(leds);
   SetKeyColor(red, green, blue);
 
-  m_uinput_fid = G13CreateUinput(this);
+  // created once the configuration that follows has been read
+  m_uinput_timer =
+      G13_Manager::Reactor().AddTimer([this] { CreateUinput(); });
+  G13_Reactor::ArmTimer(m_uinput_timer, 0);
   m_input_pipe_name = G13_Manager::Instance()->MakePipeName(this, true);
   m_input_pipe_fid = G13CreateFifo(m_input_pipe_name.c_str());
   if (m_input_pipe_fid == -1) {
     G13_ERR("failed opening input pipe " << m_input_pipe_name);
+  } else {
+    G13_Manager::Reactor().Watch(m_input_pipe_fid, EPOLLIN,
+                                 [this](uint32_t) { ReadCommandsFromPipe(); });
   }
   m_output_pipe_name = G13_Manager::Instance()->MakePipeName(this, false);
   m_output_pipe_fid = G13CreateFifo(m_output_pipe_name.c_str());
   if (m_output_pipe_fid == -1) {
     G13_ERR("failed opening output pipe " << m_output_pipe_name);
   }
+
+  StartKeyTransfer();
 }
 
 void G13_Device::Cleanup() {
-  SetKeyColor(0, 0, 0);
+  m_closing = true;
+  if (handle) {
+    // the transfer queues are shut down by now, switch the backlight off
+    // synchronously
+    unsigned char usb_data[] = {5, 0, 0, 0, 0};
+    libusb_control_transfer(
+        handle, LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, 9,
+        0x307, 0, usb_data, 5, 1000);
+  }
+  Detach();
+  if (m_input_pipe_fid > 0) {
+    G13_Manager::Reactor().Unwatch(m_input_pipe_fid);
+    close(m_input_pipe_fid);
+  }
+  if (m_output_pipe_fid > 0) {
+    close(m_output_pipe_fid);
+  }
   remove(m_input_pipe_name.c_str());
   remove(m_output_pipe_name.c_str());
-  ioctl(m_uinput_fid, UI_DEV_DESTROY);
-  close(m_uinput_fid);
+  if (m_uinput_timer >= 0) {
+    G13_Manager::Reactor().RemoveTimer(m_uinput_timer);
+  }
+  if (m_uinput_fid >= 0) {
+    ioctl(m_uinput_fid, UI_DEV_DESTROY);
+    close(m_uinput_fid);
+  }
+}
+
+/*! lets go of the USB device but keeps everything else, profiles, stick,
+ * uinput device and pipes, see G13_Manager::ParkDevice()
+ *
+ * Keys still held are released first. Whatever the LCD and the control
+ * reports were last asked to show is kept for Resume(). Transfers must no
+ * longer be pending.
+ */
+void G13_Device::Detach() {
+  if (!handle) {
+    return;
+  }
+  ReleaseKeys();
+  if (m_lcd_transfer && m_lcd_frames && !m_lcd_frame_pending) {
+    memcpy(m_lcd_pending_frame, m_lcd_transfer->buffer + G13_LCD_HEADER_SIZE,
+           G13_LCD_BUFFER_SIZE);
+    m_lcd_frame_pending = true;
+  }
   libusb_release_interface(handle, 0);
   libusb_close(handle);
+  handle = nullptr;
+  device = nullptr;
+  // closing the handle drops whatever libusb still had in flight for it
+  for (auto transfer : m_key_transfers) {
+    libusb_free_transfer(transfer);
+  }
+  m_key_transfers.clear();
+  m_async_keys = false;
+  if (m_lcd_transfer) {
+    libusb_free_transfer(m_lcd_transfer);
+    m_lcd_transfer = nullptr;
+  }
+  for (auto &control : m_control) {
+    if (control.transfer) {
+      libusb_free_transfer(control.transfer);
+      control.transfer = nullptr;
+    }
+    control.have_applied = false;
+    control.queued = false;
+  }
+}
+
+// takes over a newly opened handle for the same G13, Resume() follows
+void G13_Device::Reattach(libusb_device *dev, libusb_device_handle *handle) {
+  this->device = dev;
+  this->handle = handle;
+  m_closing = false;
+}
+
+/*! brings a reattached G13 back to where it was when it went away
+ *
+ * The configuration is not read again, nothing but the LCD frame, the
+ * backlight and the mode LEDs has to be sent to the device.
+ */
+void G13_Device::Resume() {
+  G13_OUT("Resuming device " << m_id_within_manager << " on port "
+                             << m_port_path);
+  LcdInit(false);
+  if (m_lcd_frame_pending && SubmitLcdFrame(m_lcd_pending_frame)) {
+    m_lcd_frame_pending = false;
+  }
+  for (int slot = 0; slot < CONTROL_SLOTS; slot++) {
+    SubmitControl(slot);
+  }
+  StartKeyTransfer();
+}
+
+// sends the key ups for every key and stick zone held down
+void G13_Device::ReleaseKeys() {
+  unsigned char report[G13_REPORT_SIZE]{};
+  m_key_table.ParseKeys(*this, report);
+  m_stick.Release();
+  SendEvent(EV_SYN, SYN_REPORT, 0);
+}
+
+std::string G13_Device::PortPath(libusb_device *dev) {
+  if (!dev) {
+    return "";
+  }
+  uint8_t ports[8];
+  int count = libusb_get_port_numbers(dev, ports, sizeof(ports));
+  std::string path = std::to_string(libusb_get_bus_number(dev));
+  for (int i = 0; i < count; i++) {
+    path += (i ? "." : "-") + std::to_string(ports[i]);
+  }
+  return path;
 }
 
 G13_Device::~G13_Device() {
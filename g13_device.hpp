@@ -4,15 +4,21 @@
 #ifndef G13_G13_DEVICE_HPP
 #define G13_G13_DEVICE_HPP
 
+#include "g13_command.hpp"
+#include "g13_config.hpp"
 #include "g13_lcd.hpp"
 #include "g13_manager.hpp"
 #include "g13_profile.hpp"
 #include "g13_stick.hpp"
+#include <bitset>
 #include <functional>
+#include <iostream>
 #include <libusb-1.0/libusb.h>
 #include <linux/uinput.h>
 #include <map>
 #include <memory>
+#include <string_view>
+#include <vector>
 
 namespace G13 {
 // *************************************************************************
@@ -24,10 +30,16 @@ class G13_Manager;
 class G13_Font;
 
 typedef std::shared_ptr<G13_Profile> ProfilePtr;
-typedef std::shared_ptr<G13_Action> G13_ActionPtr;
+typedef const G13_Action *G13_ActionPtr;
 typedef std::shared_ptr<G13_Font> FontPtr;
 
-const size_t G13_NUM_KEYS = 40;
+const int G13_DEFAULT_KEY_TRANSFERS = 4;
+const int G13_MAX_KEY_TRANSFERS = 32;
+// default of the profile_cache config value
+const size_t G13_PROFILE_CACHE = 8;
+// chunk size of the arena of an action bound at runtime
+const size_t G13_BOUND_ARENA_SIZE = 256;
+const size_t G13_EVENT_FRAME_SIZE = 64;
 
 class G13_Device {
 public:
@@ -45,23 +57,83 @@ public:
 
   FontPtr SwitchToFont(const std::string &name);
 
-  void SwitchToProfile(const std::string &name);
+  void SwitchToProfile(std::string_view name);
 
-  ProfilePtr Profile(const std::string &name);
+  ProfilePtr Profile(std::string_view name);
 
   void Dump(std::ostream &o, int detail = 0);
 
-  void Command(char const *str);
+  bool Command(char const *str);
+
+  static bool CompileCommand(const char *str, G13_Command &command);
+
+  // the run step of the command called name, nullptr if there is none
+  static COMMAND_RUN FindCommand(std::string_view name);
+
+  bool RunCommand(const G13_Command &command);
+
+  // output of commands such as dump, std::cout unless redirected
+  std::ostream &CommandOutput() {
+    return m_command_output ? *m_command_output : std::cout;
+  }
+
+  void SetCommandOutput(std::ostream *out) { m_command_output = out; }
+
+  [[nodiscard]] unsigned long failed_commands() const {
+    return m_failed_commands;
+  }
 
   void ReadCommandsFromPipe();
 
-  void ReadConfigFile(const std::string &filename);
+  void ProcessInput(Helper::LineBuffer &input);
+
+  void ExecuteCommandLine(char *line);
+
+  void ApplyConfig(const std::shared_ptr<const G13_Config> &config);
+
+  void ReloadConfig(const std::shared_ptr<const G13_Config> &old_config,
+                    const std::shared_ptr<const G13_Config> &new_config);
 
   int ReadKeypresses();
 
+  bool StartKeyTransfer();
+
+  void CancelTransfers();
+
+  [[nodiscard]] bool TransfersPending() const {
+    return m_transfers_in_flight > 0;
+  }
+
+  [[nodiscard]] bool async_keys() const { return m_async_keys; }
+
   void parse_joystick(unsigned char *buf);
 
-  G13_ActionPtr MakeAction(const std::string &action);
+  // holds the default actions of the stick zones
+  Helper::Arena &action_arena() { return m_action_arena; }
+
+  // parses an action into arena and makes sure uinput can send its codes
+  G13_ActionPtr MakeAction(std::string_view action, Helper::Arena &arena);
+
+  // the same, into an arena of the action's own that Unbind() lets go of
+  G13_ActionPtr MakeAction(std::string_view action);
+
+  // frees an action made by MakeAction(action) once nothing can be running it,
+  // does nothing for any other action
+  void Unbind(G13_ActionPtr action);
+
+  // gives each binding to an action made along with action one of its own
+  void KeepBindings(G13_ActionPtr action);
+
+  // makes sure uinput can send the codes of an action made elsewhere
+  G13_ActionPtr UseAction(G13_ActionPtr action);
+
+  // codes the uinput device is created with, those of all actions made
+  [[nodiscard]] const std::bitset<KEY_CNT> &input_keys() const {
+    return m_input_keys;
+  }
+  [[nodiscard]] const std::bitset<REL_CNT> &input_rels() const {
+    return m_input_rels;
+  }
 
   void SetKeyColor(int red, int green, int blue);
 
@@ -69,17 +141,54 @@ public:
 
   void SendEvent(int type, int code, int val);
 
-  void OutputPipeWrite(const std::string &out) const;
+  void FlushEvents();
+
+  void CreateUinput();
+
+  void OutputPipeWrite(const std::string &out) const {
+    OutputPipeWrite(out.c_str(), out.size());
+  }
+  void OutputPipeWrite(const char *out, size_t size) const;
 
   void LcdWrite(unsigned char *data, size_t size);
 
+  bool SubmitLcdFrame(const unsigned char *data);
+
+  void QueueControl(int slot, const unsigned char *data);
+
+  bool SubmitControl(int slot);
+
+  static void LIBUSB_CALL ControlTransferCallback(libusb_transfer *transfer);
+
+  static void LIBUSB_CALL LcdTransferCallback(libusb_transfer *transfer);
+
   // bool is_set(int key);
 
-  bool update(int key, bool v);
+  uint64_t UpdateKeyState(const unsigned char *buffer);
+
+  [[nodiscard]] bool key_down(int key) const {
+    return m_key_state >> key & 1;
+  }
 
   // used by G13_Manager
   void Cleanup();
 
+  void Detach();
+
+  void Reattach(libusb_device *dev, libusb_device_handle *handle);
+
+  void Resume();
+
+  void ReleaseKeys();
+
+  // whether RegisterContext() has run, it is not run again after Reattach()
+  [[nodiscard]] bool registered() const { return m_registered; }
+
+  // bus and ports the device is plugged into, as in sysfs: "1-2.3", empty
+  // without a device
+  static std::string PortPath(libusb_device *dev);
+
+  [[nodiscard]] const std::string &port_path() const { return m_port_path; }
 
   void RegisterContext(libusb_context *libusbContext);
 
@@ -93,9 +202,11 @@ public:
 
   static std::string DescribeLibusbErrorCode(int code);
 
-  // typedef boost::function<void(const char*)> COMMAND_FUNCTION;
-  typedef std::function<void(const char *)> COMMAND_FUNCTION;
-  typedef std::map<std::string, COMMAND_FUNCTION> CommandFunctionTable;
+  struct CommandEntry {
+    COMMAND_PARSE parse;
+    COMMAND_RUN run;
+  };
+  typedef std::map<std::string, CommandEntry, std::less<>> CommandTable;
 
   /*
           void setManager(G13_Manager manager) {
@@ -108,51 +219,134 @@ public:
 protected:
   void InitFonts();
 
-  void LcdInit();
+  ProfilePtr MakeProfile(std::string_view name,
+                         const G13_Config::ProfileRecord &record);
+
+  void EvictProfiles();
+
+  void LcdInit(bool show_logo = true);
 
-  void InitCommands();
+  static void InitCommands();
 
-  // typedef void (COMMAND_FUNCTION)( G13_Device*, const char *, const char * );
-  CommandFunctionTable _command_table;
+  void CommandFailed(const std::string &error);
 
-  // struct timeval _event_time;
-  struct input_event m_event {};
+  void ProcessKeyReport(unsigned char *buffer, const struct timespec &arrival);
+
+  void ProcessFrame(int type, const unsigned char *payload, size_t length);
+
+  bool SubmitKeyTransfer(libusb_transfer *transfer);
+
+  static void LIBUSB_CALL KeyTransferCallback(libusb_transfer *transfer);
+
+  static CommandTable _command_table;
+
+  // events collected while handling one report, written at SYN_REPORT
+  struct input_event m_event_frame[G13_EVENT_FRAME_SIZE]{};
+  size_t m_event_frame_count = 0;
+  size_t m_events_written = 0;
+
+  // arrival time of the report being handled, stamped on all its events
+  struct timespec m_report_arrival {};
+  bool m_in_report = false;
+
+  // report arrival to uinput write, in microseconds
+  unsigned long m_latency_samples = 0;
+  unsigned long long m_latency_total = 0;
+  unsigned long m_latency_max = 0;
 
   int m_id_within_manager;
   libusb_context *m_ctx;
+  std::string m_port_path;
+  bool m_registered = false;
 
   int m_uinput_fid;
+  int m_uinput_timer = -1; // (re)creates uinput once bindings settle
+  std::bitset<KEY_CNT> m_input_keys;
+  std::bitset<REL_CNT> m_input_rels;
 
   int m_input_pipe_fid{};
   std::string m_input_pipe_name;
+  Helper::LineBuffer m_input_buffer;
+  std::ostream *m_command_output = nullptr;
+  unsigned long m_failed_commands = 0;
+  bool m_input_framed = false;
   int m_output_pipe_fid{};
   std::string m_output_pipe_name;
 
+  // every configuration applied, profiles may point to their actions
+  std::vector<std::shared_ptr<const G13_Config>> m_configs;
+
   std::map<std::string, FontPtr> pFonts;
   FontPtr m_currentFont;
-  std::map<std::string, ProfilePtr> m_profiles;
+  std::map<std::string, ProfilePtr, std::less<>> m_profiles;
   ProfilePtr m_currentProfile;
-
+  // when each profile made from a ProfileRecord was last selected, those
+  // bound on at runtime are left out as they can't be made again
+  std::map<std::string, uint64_t, std::less<>> m_profile_used;
+  uint64_t m_profile_clock = 0;
+  G13_KeyTable m_key_table; // m_currentProfile flattened
+
+  // before m_stick, which binds its zones here, like m_input_keys
+  Helper::Arena m_action_arena;
+  // actions bound at runtime, each in its own arena, see Unbind()
+  std::map<G13_ActionPtr, Helper::Arena> m_bound_arenas;
+  std::vector<Helper::Arena> m_unbound_arenas;
   G13_LCD m_lcd;
   G13_Stick m_stick;
 
-  bool keys[G13_NUM_KEYS]{};
+  uint64_t m_key_state = 0; // one bit per G13_KEY_STRINGS position
+
+  // asynchronous key report reading, see StartKeyTransfer()
+  std::vector<libusb_transfer *> m_key_transfers;
+  int m_key_transfers_in_flight = 0;
+  int m_transfers_in_flight = 0;
+  unsigned long m_key_reports = 0;
+  unsigned long m_failed_transfers = 0;
+  unsigned long m_ring_drained = 0;
+
+  // asynchronous LCD writes, see LcdWrite()
+  libusb_transfer *m_lcd_transfer = nullptr;
+  bool m_lcd_in_flight = false;
+  bool m_lcd_frame_pending = false;
+  unsigned char m_lcd_pending_frame[G13_LCD_BUFFER_SIZE]{};
+  unsigned long m_lcd_frames = 0;
+  unsigned long m_lcd_frames_replaced = 0;
+
+  // asynchronous control transfers, one slot per report, see QueueControl()
+  enum { CONTROL_MODE_LEDS, CONTROL_KEY_COLOR, CONTROL_SLOTS };
+  static const size_t G13_CONTROL_SIZE = 5;
+  struct ControlSlot {
+    uint16_t report;
+    libusb_transfer *transfer;
+    unsigned char wanted[G13_CONTROL_SIZE];
+    unsigned char applied[G13_CONTROL_SIZE];
+    bool have_applied;
+    bool queued;
+    bool in_flight;
+  };
+  ControlSlot m_control[CONTROL_SLOTS]{};
+  unsigned long m_control_skipped = 0;
+  unsigned long m_control_superseded = 0;
+  bool m_async_keys = false;
+  bool m_closing = false;
 
 private:
   libusb_device_handle *handle;
   libusb_device *device;
 };
 
-/*
-inline bool G13_Device::is_set(int key) {
-    return keys[key];
-}
-*/
-
-inline bool G13_Device::update(int key, bool v) {
-  bool old = keys[key];
-  keys[key] = v;
-  return old != v;
+/*! stores the key bits of a report, returns the bits that changed
+ *
+ * Reports that only carry stick movement cost a load and a compare here.
+ */
+inline uint64_t G13_Device::UpdateKeyState(const unsigned char *buffer) {
+  uint64_t state = (uint64_t(buffer[3]) | uint64_t(buffer[4]) << 8 |
+                    uint64_t(buffer[5]) << 16 | uint64_t(buffer[6]) << 24 |
+                    uint64_t(buffer[7]) << 32) &
+                   G13_PARSED_KEYS_MASK;
+  uint64_t changed = state ^ m_key_state;
+  m_key_state = state;
+  return changed;
 }
 } // namespace G13
 
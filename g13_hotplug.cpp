@@ -6,7 +6,6 @@
 #include "g13.hpp"
 #include "g13_device.hpp"
 #include "g13_manager.hpp"
-#include <libevdev-1.0/libevdev/libevdev.h>
 #include <log4cpp/OstreamAppender.hh>
 #include <memory>
 
@@ -24,9 +23,6 @@ void G13::G13_Manager::DiscoverG13s(libusb_device **devs, ssize_t count) {
     }
     if (desc.idVendor == G13_VENDOR_ID && desc.idProduct == G13_PRODUCT_ID) {
       OpenAndAddG13(devs[i]);
-      for (auto g13 : g13s) {
-        SetupDevice(g13);
-      }
     }
   }
 }
@@ -60,8 +56,7 @@ int G13::G13_Manager::OpenAndAddG13(libusb_device *dev) {
 
   if (error == LIBUSB_SUCCESS) {
     G13_DBG("Interface successfully claimed");
-    auto g13 = new G13_Device(dev, libusbContext, handle, g13s.size());
-    g13s.push_back(g13);
+    AddG13(dev, handle);
     return 0;
   }
 
@@ -70,6 +65,37 @@ int G13::G13_Manager::OpenAndAddG13(libusb_device *dev) {
   return 1;
 }
 
+/*! puts an opened G13 into service, as the device parked for its port if
+ * there is one
+ *
+ * A G13 unplugged only a moment ago may still be parking, waiting for its
+ * transfers to call back. The new handle then waits in g13s_returning until
+ * ReapClosedDevices() has parked the old device and calls this again.
+ */
+void G13::G13_Manager::AddG13(libusb_device *dev,
+                              libusb_device_handle *handle) {
+  auto port_path = G13_Device::PortPath(dev);
+  for (auto parking : g13s_parking) {
+    if (parking->port_path() == port_path) {
+      G13_OUT("Device " << parking->id_within_manager() << " is back on port "
+                        << port_path << ", waiting for it to be parked");
+      DropReturning(port_path);
+      g13s_returning[port_path] = {dev, handle};
+      return;
+    }
+  }
+  auto g13 = Unpark(port_path);
+  if (g13) {
+    G13_OUT("Device " << g13->id_within_manager() << " is back on port "
+                      << g13->port_path());
+    g13->Reattach(dev, handle);
+  } else {
+    g13 = new G13_Device(dev, libusbContext, handle, NextDeviceId());
+  }
+  g13s.push_back(g13);
+  g13s_pending.push_back(g13);
+}
+
 int LIBUSB_CALL G13::G13_Manager::HotplugCallbackEnumerate(
     struct libusb_context *ctx, struct libusb_device *dev,
     libusb_hotplug_event event, void *user_data) {
@@ -92,11 +118,17 @@ int LIBUSB_CALL G13::G13_Manager::HotplugCallbackInsert(
       return 0;
     }
   }
+  for (auto &returning : g13s_returning) {
+    if (dev == returning.second.dev) {
+      return 0;
+    }
+  }
 
   // It's brand new!
   OpenAndAddG13(dev);
 
-  // NOTE: can not SetupDevice() from this thread
+  // NOTE: can not SetupDevice() from this thread, Run() picks it up from
+  // g13s_pending
 
   return 0; // Rearm
 }
@@ -106,22 +138,29 @@ int LIBUSB_CALL G13::G13_Manager::HotplugCallbackRemove(
     libusb_hotplug_event event, void *user_data) {
 
   G13_OUT("USB device disconnected");
-  int i = 0;
-  for (auto iter = g13s.begin(); (iter != g13s.end()); ++i) {
-    if (dev == (*iter)->Device()) {
-      G13_OUT("Closing device " << i);
-      auto g13 = iter;
-      // (*g13)->Cleanup();
-      iter = g13s.erase(iter);  // remove from vector first
-      delete (*g13);            // delete the object after
-    } else {
-      iter++;
+  for (auto g13 : std::vector<G13_Device *>(g13s)) {
+    if (dev == g13->Device()) {
+      G13_OUT("Closing device " << g13->id_within_manager());
+      // parked by ReapClosedDevices() once its transfers have called back
+      CloseDevice(g13, true);
     }
   }
+  std::string returned;
+  for (auto &returning : g13s_returning) {
+    if (dev == returning.second.dev) {
+      returned = returning.first;
+    }
+  }
+  DropReturning(returned);
   return 0; // Rearm
 }
 
 void G13::G13_Manager::SetupDevice(G13_Device *g13) {
+  if (g13->registered()) {
+    // came back from ParkDevice(), everything but the USB side is still set
+    g13->Resume();
+    return;
+  }
 
   G13_OUT("Setting up device ");
   g13->RegisterContext(libusbContext);
@@ -132,10 +171,8 @@ void G13::G13_Manager::SetupDevice(G13_Device *g13) {
   G13_OUT("Active Stick zones ");
   g13->stick().dump(std::cout);
 
-  std::string config_fn = getStringConfigValue("config");
-  if (!config_fn.empty()) {
-    G13_OUT("config_fn = " << config_fn);
-    g13->ReadConfigFile(config_fn);
+  if (auto shared = Config()) {
+    g13->ApplyConfig(shared);
   }
 }
 
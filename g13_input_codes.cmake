@@ -0,0 +1,47 @@
+# This script generates g13_input_codes.h, the list of every KEY_, BTN_ and
+# REL_ code in <linux/input-event-codes.h>, as G13_KEY(), G13_BTN() and
+# G13_REL() entries. Only the names are taken from the header, the codes are
+# left to the compiler, see G13_SYMBOLS in g13_keys.hpp.
+#
+#   cmake -DINPUT=/usr/include/linux/input-event-codes.h \
+#         -DOUTPUT=g13_input_codes.h -P g13_input_codes.cmake
+
+cmake_minimum_required(VERSION 3.13)
+
+if(NOT INPUT OR NOT OUTPUT)
+  message(FATAL_ERROR "usage: cmake -DINPUT=<header> -DOUTPUT=<file> -P ${CMAKE_CURRENT_LIST_FILE}")
+endif()
+
+# limits and the markers for the start of a range, which share their code
+# with the first real button of it
+set(SKIPPED
+        KEY_RESERVED KEY_MIN_INTERESTING KEY_MAX KEY_CNT
+        BTN_MISC BTN_MOUSE BTN_JOYSTICK BTN_GAMEPAD BTN_DIGI BTN_WHEEL
+        BTN_TRIGGER_HAPPY
+        REL_RESERVED REL_MAX REL_CNT)
+
+file(STRINGS "${INPUT}" DEFINES REGEX "^#define[ \t]+(KEY|BTN|REL)_[A-Za-z0-9_]+[ \t]")
+
+set(CODES "")
+set(ALIASES "")
+foreach(DEFINE IN LISTS DEFINES)
+  string(REGEX MATCH "^#define[ \t]+((KEY|BTN|REL)_([A-Za-z0-9_]+))[ \t]+([^ \t]+)" _ "${DEFINE}")
+  set(NAME ${CMAKE_MATCH_1})
+  if(NAME IN_LIST SKIPPED)
+    continue()
+  endif()
+  set(ENTRY "G13_${CMAKE_MATCH_2}(${CMAKE_MATCH_3})")
+  # aliases go last, so that the table maps a code to its proper name first
+  if(CMAKE_MATCH_4 MATCHES "^(0x[0-9a-fA-F]+|[0-9]+)$")
+    string(APPEND CODES "${ENTRY}\n")
+  else()
+    string(APPEND ALIASES "${ENTRY}\n")
+  endif()
+endforeach()
+
+file(WRITE "${OUTPUT}.tmp"
+        "// generated from ${INPUT} by g13_input_codes.cmake, do not edit\n"
+        "${CODES}${ALIASES}")
+# keep the timestamp if nothing changed, so that nothing gets rebuilt
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
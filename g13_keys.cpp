@@ -2,34 +2,58 @@
  *
  */
 
-// TODO: check out why g13.h needs to be included before libevdev
 // clang-format off
 #include "g13.hpp"
 #include "g13_device.hpp"
 #include "g13_keys.hpp"
+#include "g13_profile.hpp"
 #include "helper.hpp"
 // clang-format on
 
 namespace G13 {
 
-void G13_Key::dump(std::ostream &o) const {
-  o << G13_Manager::Instance()->FindG13KeyName(index()) << "(" << index()
-    << ") : ";
-  if (action()) {
-    action()->dump(o);
+void G13_KeyTable::Clear() {
+  _bound = 0;
+  _actions.fill(nullptr);
+}
+
+void G13_KeyTable::set_action(G13_KEY_INDEX key, G13_ActionPtr action) {
+  _actions[key] = action;
+  if (action) {
+    _bound |= uint64_t(1) << key;
   } else {
-    o << "(no action)";
+    _bound &= ~(uint64_t(1) << key);
   }
 }
 
-// *************************************************************************
+/*! acts on the keys that changed since the last report
+ *
+ * Only the set bits of the changed mask are visited, lowest first. An action
+ * may switch profiles, which refills this table, so the actions of all
+ * changed keys are taken before any of them runs.
+ */
+void G13_KeyTable::ParseKeys(G13_Device &keypad, const unsigned char *buf) {
+  uint64_t changed = keypad.UpdateKeyState(buf) & _bound;
+  std::array<G13_ActionPtr, G13_NUM_KEYS> acting;
+  for (uint64_t bits = changed; bits; bits &= bits - 1) {
+    int key = __builtin_ctzll(bits);
+    acting[key] = _actions[key];
+  }
+  while (changed) {
+    int key = __builtin_ctzll(changed);
+    changed &= changed - 1;
+    acting[key]->act(keypad, keypad.key_down(key));
+  }
+}
 
-void G13_Key::ParseKey(const unsigned char *byte, G13_Device *g13) {
-  bool key_is_down = byte[_index.offset] & _index.mask;
-  auto key_state_changed = g13->update(_index.index, key_is_down);
+// *************************************************************************
 
-  if (key_state_changed && _action) {
-    _action->act(*g13, key_is_down);
+void G13_Profile::dump_key(std::ostream &o, G13_KEY_INDEX key) const {
+  o << G13_Manager::FindG13KeyName(key) << "(" << key << ") : ";
+  if (auto action = this->action(key)) {
+    action->dump(o);
+  } else {
+    o << "(no action)";
   }
 }
 
@@ -5,6 +5,11 @@
 #ifndef G13_G13_KEYS_HPP
 #define G13_G13_KEYS_HPP
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <linux/input-event-codes.h>
 #include <string>
 #include <vector>
 
@@ -17,7 +22,7 @@ namespace G13 {
  * format.  Do NOT remove or insert items in this list.
  */
 // clang-format off
-static const char* G13_KEY_STRINGS[] = {  // formerly G13_KEY_SEQ
+static constexpr const char* G13_KEY_STRINGS[] = {  // formerly G13_KEY_SEQ
   /* byte 3 */
   "G1", "G2", "G3", "G4", "G5", "G6", "G7", "G8",
   /* byte 4 */
@@ -31,58 +36,104 @@ static const char* G13_KEY_STRINGS[] = {  // formerly G13_KEY_SEQ
 };
 // clang-format on
 
+const size_t G13_NUM_KEYS = 40;
+
 /*! sequence containing the
  * G13 keys that shouldn't be tested input.  These aren't actually keys,
  * but they are in the bitmap defined by G13_KEY_SEQ.
  */
 // formerly G13_NONPARSED_KEY_SEQ
-static const char *G13_NONPARSED_KEYS[] = {
-    "UNDEF1", "LIGHT_STATE", "UNDEF3",     "LIGHT",
-    "LIGHT2", "UNDEF3",      "MISC_TOGGLE"};
+static constexpr const char *G13_NONPARSED_KEYS[] = {
+    "UNDEF1", "LIGHT_STATE", "UNDEF3", "LIGHT", "LIGHT2", "MISC_TOGGLE"};
 
-/*! sequence containing the
- * names of keyboard keys we can send through binding actions.
- * These correspond to KEY_xxx value definitions in <linux/input.h>,
- * i.e. ESC is KEY_ESC, 1 is KEY_1, etc.
- */
-// formerly KB_INPUT_KEY_SEQ
-// clang-format off
-static const char*  G13_SYMBOLS[] = {
-  "ESC", "1", "2", "3", "4", "5", "6", "7", "8", "9", "0", "MINUS", "EQUAL", "BACKSPACE",
-  "TAB", "Q", "W", "E", "R", "T", "Y", "U", "I", "O",
-  "P", "LEFTBRACE", "RIGHTBRACE", "ENTER", "LEFTCTRL", "RIGHTCTRL", "A", "S", "D", "F",
-  "G", "H", "J", "K", "L", "SEMICOLON",
-  "APOSTROPHE", "GRAVE", "LEFTSHIFT", "BACKSLASH", "Z", "X", "C", "V", "B", "N", "M",
-  "COMMA", "DOT", "SLASH", "RIGHTSHIFT",
-  "KPASTERISK", "LEFTALT", "RIGHTALT", "SPACE", "CAPSLOCK", "F1", "F2", "F3", "F4", "F5",
-  "F6", "F7", "F8", "F9", "F10", "F11", "F12",
-  "NUMLOCK", "SCROLLLOCK", "KP7", "KP8", "KP9", "KPMINUS", "KP4", "KP5", "KP6", "KPPLUS",
-  "KP1", "KP2", "KP3", "KP0", "KPDOT",
-  "KPSLASH", "LEFT", "RIGHT", "UP", "DOWN", "PAGEUP", "PAGEDOWN", "HOME", "END", "INSERT",
-  "DELETE", "F13", "F14", "F15", "F16",
-  "F17", "F18", "F19", "F20", "F21", "F22", "F23", "F24", "NEXTSONG", "PLAYPAUSE",
-  "PREVIOUSSONG"
-};
-// clang-format on
+// the bits of the G13_KEY_STRINGS positions named in names
+template <size_t N>
+constexpr uint64_t G13_KeyBits(const char *const (&names)[N]) {
+  uint64_t bits = 0;
+  for (auto name : names) {
+    for (size_t key = 0; key < G13_NUM_KEYS; key++) {
+      auto a = name, b = G13_KEY_STRINGS[key];
+      while (*a && *a == *b) {
+        a++;
+        b++;
+      }
+      if (*a == *b) {
+        bits |= uint64_t(1) << key;
+      }
+    }
+  }
+  return bits;
+}
 
-// formerly M_INPUT_BTN_SEQ
-/*! m_INPUT_BTN_SEQ is a Boost Preprocessor sequence containing the
- * names of button events we can send through binding actions.
- * These correspond to BTN_xxx value definitions in <linux/input.h>,
- * i.e. LEFT is BTN_LEFT, RIGHT is BTN_RIGHT, etc.
- *
- * The binding names have prefix M to avoid naming conflicts.
- * e.g. LEFT keyboard button and LEFT mouse button
- * i.e. LEFT mouse button is named MLEFT, MIDDLE mouse button is MMIDDLE
+/*! bits of the G13_KEY_STRINGS positions in a key report, i.e. bytes 3 to 7
+ * read as one little endian number, that are real keys
  */
+constexpr uint64_t G13_PARSED_KEYS_MASK =
+    ((uint64_t(1) << G13_NUM_KEYS) - 1) & ~G13_KeyBits(G13_NONPARSED_KEYS);
 
-// clang-format off
-static const char* G13_BTN_SEQ[] = { "LEFT", "RIGHT", "MIDDLE", "SIDE", "EXTRA" };
-// clang-format on
+static_assert(__builtin_popcountll(G13_KeyBits(G13_NONPARSED_KEYS)) ==
+                  std::size(G13_NONPARSED_KEYS),
+              "every name in G13_NONPARSED_KEYS must be in G13_KEY_STRINGS");
 
 typedef int G13_KEY_INDEX;
 typedef int LINUX_KEY_VALUE;
 const LINUX_KEY_VALUE BAD_KEY_VALUE = -1;
 
+struct G13_Symbol {
+  const char *name;
+  LINUX_KEY_VALUE code;
+};
+
+// REL_ codes are or'ed with this, so that they can share key lists with keys
+const LINUX_KEY_VALUE G13_REL_FLAG = 0x10000;
+// and with this as well to move the other way, bound as -REL_xxx
+const LINUX_KEY_VALUE G13_REL_NEGATIVE = 0x20000;
+
+/*! names of every key, button and relative axis we can send through binding
+ * actions, with their codes from <linux/input-event-codes.h>
+ *
+ * Keys are named like their KEY_xxx definition without the prefix, i.e. ESC
+ * is KEY_ESC, 1 is KEY_1, etc. Buttons get an M prefix instead of BTN_ to
+ * avoid naming conflicts with keys, i.e. the LEFT mouse button is MLEFT.
+ * Relative axes keep their REL_ prefix and are flagged with G13_REL_FLAG.
+ *
+ * The list of names is generated from the kernel header at build time, see
+ * g13_input_codes.cmake. Aliases come after the names they stand for.
+ */
+// formerly KB_INPUT_KEY_SEQ and M_INPUT_BTN_SEQ
+#define G13_KEY(name) G13_Symbol{#name, KEY_##name},
+#define G13_BTN(name) G13_Symbol{"M" #name, BTN_##name},
+#define G13_REL(name) G13_Symbol{"REL_" #name, G13_REL_FLAG | REL_##name},
+static constexpr G13_Symbol G13_SYMBOLS[] = {
+#include "g13_input_codes.h"
+};
+#undef G13_KEY
+#undef G13_BTN
+#undef G13_REL
+
+class G13_Action;
+class G13_Device;
+typedef const G13_Action *G13_ActionPtr;
+
+/*! the flattened bindings of the active profile
+ *
+ * Kept as columns indexed by key bit, so that parsing a report only touches
+ * the bound mask and the action array.
+ */
+class G13_KeyTable {
+public:
+  void Clear();
+  void set_action(G13_KEY_INDEX key, G13_ActionPtr action);
+  void ParseKeys(G13_Device &keypad, const unsigned char *buf);
+
+  [[nodiscard]] G13_ActionPtr action(G13_KEY_INDEX key) const {
+    return _bound >> key & 1 ? _actions[key] : nullptr;
+  }
+
+protected:
+  uint64_t _bound = 0; // one bit per key that has an action
+  std::array<G13_ActionPtr, G13_NUM_KEYS> _actions;
+};
+
 } // namespace G13
 #endif // G13_G13_KEYS_HPP
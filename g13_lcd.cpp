@@ -28,34 +28,95 @@
 
 namespace G13 {
 
-void G13_Device::LcdInit() {
+void G13_Device::LcdInit(bool show_logo) {
   int error = libusb_control_transfer(handle, 0, 9, 1, 0, nullptr, 0, 1000);
   if (error != LIBUSB_SUCCESS) {
     G13_ERR("Error when initializing LCD endpoint: "
             << G13_Device::DescribeLibusbErrorCode(error));
-  } else {
+  } else if (show_logo) {
     LcdWrite(g13_logo, sizeof(g13_logo));
   }
 }
 
+/*! queues a frame for the LCD without waiting for the USB transfer
+ *
+ * At most one transfer is in flight per device. A frame arriving while one
+ * is goes into the single pending slot, replacing whatever was waiting there,
+ * so only the latest frame is ever sent once the panel is ready again and a
+ * fast client can not build up a queue in front of it. While the G13 is
+ * being unplugged or gone the slot holds the frame Resume() sends.
+ */
 void G13_Device::LcdWrite(unsigned char *data, size_t size) {
   if (size != G13_LCD_BUFFER_SIZE) {
-    G13_LOG(log4cpp::Priority::ERROR << "Invalid LCD data size " << size
-                                     << ", should be " << G13_LCD_BUFFER_SIZE);
+    G13_ERR("Invalid LCD data size " << size << ", should be "
+                                      << G13_LCD_BUFFER_SIZE);
     return;
   }
-  unsigned char buffer[G13_LCD_BUFFER_SIZE + 32];
-  memset(buffer, 0, G13_LCD_BUFFER_SIZE + 32);
-  buffer[0] = 0x03;
-  memcpy(buffer + 32, data, G13_LCD_BUFFER_SIZE);
-  int bytes_written;
-  int error = libusb_interrupt_transfer(
-      handle, LIBUSB_ENDPOINT_OUT | G13_LCD_ENDPOINT, buffer,
-      G13_LCD_BUFFER_SIZE + 32, &bytes_written, 1000);
-  if (error) {
-    G13_LOG(log4cpp::Priority::ERROR << "Error when transferring image: "
-                                     << DescribeLibusbErrorCode(error) << ", "
-                                     << bytes_written << " bytes written");
+  if (!m_lcd_in_flight && handle && SubmitLcdFrame(data)) {
+    m_lcd_frame_pending = false;
+    return;
+  }
+  if (m_lcd_frame_pending) {
+    m_lcd_frames_replaced++;
+  }
+  memcpy(m_lcd_pending_frame, data, G13_LCD_BUFFER_SIZE);
+  m_lcd_frame_pending = true;
+}
+
+bool G13_Device::SubmitLcdFrame(const unsigned char *data) {
+  if (m_closing) {
+    return false;
+  }
+  if (!m_lcd_transfer) {
+    m_lcd_transfer = libusb_alloc_transfer(0);
+    if (!m_lcd_transfer) {
+      G13_ERR("Could not allocate LCD transfer");
+      return false;
+    }
+    auto buffer = static_cast<unsigned char *>(
+        calloc(1, G13_LCD_HEADER_SIZE + G13_LCD_BUFFER_SIZE));
+    buffer[0] = 0x03;
+    libusb_fill_interrupt_transfer(
+        m_lcd_transfer, handle, LIBUSB_ENDPOINT_OUT | G13_LCD_ENDPOINT, buffer,
+        G13_LCD_HEADER_SIZE + G13_LCD_BUFFER_SIZE, LcdTransferCallback, this,
+        1000);
+    m_lcd_transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+  }
+  memcpy(m_lcd_transfer->buffer + G13_LCD_HEADER_SIZE, data,
+         G13_LCD_BUFFER_SIZE);
+  int error = libusb_submit_transfer(m_lcd_transfer);
+  if (error != LIBUSB_SUCCESS) {
+    G13_ERR("Error when transferring image: "
+            << DescribeLibusbErrorCode(error));
+    return false;
+  }
+  m_lcd_in_flight = true;
+  m_transfers_in_flight++;
+  m_lcd_frames++;
+  return true;
+}
+
+void LIBUSB_CALL G13_Device::LcdTransferCallback(libusb_transfer *transfer) {
+  auto g13 = static_cast<G13_Device *>(transfer->user_data);
+  g13->m_lcd_in_flight = false;
+  g13->m_transfers_in_flight--;
+
+  switch (transfer->status) {
+  case LIBUSB_TRANSFER_COMPLETED:
+  case LIBUSB_TRANSFER_CANCELLED:
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    break;
+  default:
+    G13_ERR("Error when transferring image: transfer status "
+            << transfer->status << ", " << transfer->actual_length
+            << " bytes written");
+    break;
+  }
+
+  // kept when it can not be sent, while closing it is the frame to resume with
+  if (g13->m_lcd_frame_pending &&
+      g13->SubmitLcdFrame(g13->m_lcd_pending_frame)) {
+    g13->m_lcd_frame_pending = false;
   }
 }
 
@@ -94,7 +155,7 @@ void G13_LCD::image_setpixel(unsigned row, unsigned col) {
 BYTES_PER_ROW * 8; unsigned char mask = 1 << ((row)&7);
 
     if (offset >= G13_LCD_BUF_SIZE) {
-        G13_LOG(log4cpp::Priority::ERROR << "bad offset " << offset << " for "
+        G13_ERR("bad offset " << offset << " for "
 << (row) << " x "
                                          << (col));
         return;
@@ -110,7 +171,7 @@ void G13_LCD::image_clearpixel(unsigned row, unsigned col) {
 BYTES_PER_ROW * 8; unsigned char mask = 1 << ((row)&7);
 
     if (offset >= G13_LCD_BUF_SIZE) {
-        G13_LOG(log4cpp::Priority::ERROR << "bad offset " << offset << " for "
+        G13_ERR("bad offset " << offset << " for "
 << (row) << " x "
                                          << (col));
         return;
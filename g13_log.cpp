@@ -1,33 +1,61 @@
 // clang-format off
 #include "g13.hpp"
 // clang-format on
-#include <log4cpp/OstreamAppender.hh>
+#include "g13_log_appender.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <log4cpp/BasicLayout.hh>
+#include <unistd.h>
 
 namespace G13 {
-void G13_Manager::start_logging() {
-  log4cpp::Appender *appender1 =
-      new log4cpp::OstreamAppender("console", &std::cout);
-  appender1->setLayout(new log4cpp::BasicLayout());
+int g13_log_priority = log4cpp::Priority::INFO;
+
+/*! logs to log_file, or to stdout if it is empty
+ *
+ * Writing is left to a background thread, see G13_AsyncAppender, so a slow
+ * console or disk never holds up the event path.
+ */
+void G13_Manager::start_logging(const std::string &log_file) {
+  int fd = STDOUT_FILENO;
+  std::string error;
+  if (!log_file.empty()) {
+    fd = open(log_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+              0644);
+    if (fd < 0) {
+      error = strerror(errno);
+      fd = STDOUT_FILENO;
+    }
+  }
+
+  log4cpp::Appender *appender = new G13_AsyncAppender("g13d", fd);
+  appender->setLayout(new log4cpp::BasicLayout());
   log4cpp::Category &root = log4cpp::Category::getRoot();
-  root.addAppender(appender1);
-
-  // TODO: this is for later when --log_file is implemented
-  //    log4cpp::Appender *appender2 = new log4cpp::FileAppender("default",
-  //    "g13d-output.log"); appender2->setLayout(new log4cpp::BasicLayout());
-  //    log4cpp::Category &sub1 =
-  //    log4cpp::Category::getInstance(std::string("sub1"));
-  //    sub1.addAppender(appender2);
+  root.addAppender(appender);
+
+  if (!error.empty()) {
+    G13_ERR("Could not open log file " << log_file << ": " << error);
+  }
+}
+
+// writes out everything still queued
+void G13_Manager::stop_logging() {
+  log4cpp::Category::getRoot().removeAllAppenders();
 }
 
 void G13_Manager::SetLogLevel(log4cpp::Priority::PriorityLevel lvl) {
-  G13_OUT("set log level to " << lvl);
+  log4cpp::Category::getRoot().setPriority(lvl);
+  g13_log_priority = lvl;
+  if (lvl > G13_LOG_MIN_LEVEL) {
+    G13_OUT("log level " << log4cpp::Priority::getPriorityName(lvl)
+                         << " is not compiled in, see G13_LOG_MIN_LEVEL");
+  }
 }
 
 void G13_Manager::SetLogLevel(const std::string &level) {
-  log4cpp::Category &root = log4cpp::Category::getRoot();
   try {
     auto numLevel = log4cpp::Priority::getPriorityValue(level);
-    root.setPriority(numLevel);
+    SetLogLevel(static_cast<log4cpp::Priority::PriorityLevel>(numLevel));
   } catch (std::invalid_argument &e) {
     G13_ERR("unknown log level " << level);
   }
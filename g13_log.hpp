@@ -7,9 +7,32 @@
 
 #include <log4cpp/Category.hh>
 
-#define G13_LOG(message) log4cpp::Category::getRoot() << message
-#define G13_ERR(message) log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << message
-#define G13_DBG(message) log4cpp::Category::getRoot() << log4cpp::Priority::DEBUG << message
-#define G13_OUT(message) log4cpp::Category::getRoot() << log4cpp::Priority::INFO << message
+// least severe level compiled in at all, anything below it costs nothing
+#ifndef G13_LOG_MIN_LEVEL
+#define G13_LOG_MIN_LEVEL log4cpp::Priority::DEBUG
+#endif
+
+namespace G13 {
+// mirrors the root category's priority so that checking it is a load,
+// only to be changed through G13_Manager::SetLogLevel()
+extern int g13_log_priority;
+} // namespace G13
+
+/*! logs message, an ostream << chain, at priority
+ *
+ * The message is not evaluated at all unless the level is compiled in and
+ * currently enabled.
+ */
+#define G13_LOG(priority, message)                                             \
+  do {                                                                         \
+    if ((priority) <= G13_LOG_MIN_LEVEL &&                                     \
+        (priority) <= G13::g13_log_priority) {                                 \
+      log4cpp::Category::getRoot() << (priority) << message;                   \
+    }                                                                          \
+  } while (false)
+
+#define G13_ERR(message) G13_LOG(log4cpp::Priority::ERROR, message)
+#define G13_DBG(message) G13_LOG(log4cpp::Priority::DEBUG, message)
+#define G13_OUT(message) G13_LOG(log4cpp::Priority::INFO, message)
 
 #endif //G13_G13_LOG_HPP
@@ -0,0 +1,156 @@
+/* This file contains the log4cpp appender g13d logs through
+ *
+ */
+
+#include "g13_log_appender.hpp"
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <log4cpp/LoggingEvent.hh>
+#include <memory>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace G13 {
+
+G13_AsyncAppender::G13_AsyncAppender(const std::string &name, int fd)
+    : log4cpp::LayoutAppender(name), m_fd(fd) {
+  for (size_t i = 0; i < RING_SIZE; i++) {
+    m_ring[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  m_wake_fd = eventfd(0, EFD_CLOEXEC);
+
+  // the writer inherits this mask, with every signal blocked SIGTERM and
+  // SIGINT are left to the signalfd of the reactor and g13d shuts down cleanly
+  sigset_t all, was;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &was);
+  m_thread = std::thread(&G13_AsyncAppender::Run, this);
+  pthread_sigmask(SIG_SETMASK, &was, nullptr);
+}
+
+G13_AsyncAppender::~G13_AsyncAppender() {
+  close();
+  ::close(m_wake_fd);
+  if (m_fd > STDERR_FILENO) {
+    ::close(m_fd);
+  }
+}
+
+void G13_AsyncAppender::close() {
+  if (!m_thread.joinable()) {
+    return;
+  }
+  m_stopping = true;
+  uint64_t one = 1;
+  write(m_wake_fd, &one, sizeof(one));
+  m_thread.join();
+}
+
+/*! queues a copy of the record, called on the thread logging
+ *
+ * Claims a slot with a single compare and swap, the classic bounded MPMC
+ * queue where every slot carries the sequence number it is waiting for.
+ * A full ring drops the record rather than waiting for the writer.
+ */
+void G13_AsyncAppender::_append(const log4cpp::LoggingEvent &event) {
+  size_t pos = m_head.load(std::memory_order_relaxed);
+  Record *record;
+  while (true) {
+    record = &m_ring[pos & (RING_SIZE - 1)];
+    size_t sequence = record->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<ptrdiff_t>(sequence - pos);
+    if (diff == 0) {
+      if (m_head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = m_head.load(std::memory_order_relaxed);
+    }
+  }
+
+  record->priority = event.priority;
+  record->seconds = event.timeStamp.getSeconds();
+  record->microseconds = event.timeStamp.getMicroSeconds();
+  if (event.message.size() > MESSAGE_SIZE) {
+    record->spill = new std::string(event.message);
+  } else {
+    record->spill = nullptr;
+    memcpy(record->message, event.message.data(), event.message.size());
+    record->length = event.message.size();
+  }
+  record->sequence.store(pos + 1, std::memory_order_release);
+
+  // pairs with the fence in Run(): either the writer sees the record, or
+  // this sees it sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_sleeping.exchange(false)) {
+    uint64_t one = 1;
+    write(m_wake_fd, &one, sizeof(one));
+  }
+}
+
+/*! the writer thread, sleeps on an eventfd while the ring is empty
+ */
+void G13_AsyncAppender::Run() {
+  while (true) {
+    Record &record = m_ring[m_tail & (RING_SIZE - 1)];
+    if (record.sequence.load(std::memory_order_acquire) == m_tail + 1) {
+      std::unique_ptr<std::string> spill(record.spill);
+      log4cpp::LoggingEvent event(
+          "", spill ? *spill : std::string(record.message, record.length), "",
+          record.priority);
+      event.timeStamp =
+          log4cpp::TimeStamp(record.seconds, record.microseconds);
+      record.sequence.store(m_tail + RING_SIZE, std::memory_order_release);
+      m_tail++;
+      Write(event);
+      continue;
+    }
+
+    auto dropped = m_dropped.exchange(0);
+    if (dropped) {
+      m_dropped_total += dropped;
+      Write(log4cpp::LoggingEvent(
+          "", std::to_string(dropped) + " log messages dropped", "",
+          log4cpp::Priority::WARN));
+    }
+
+    if (m_stopping) {
+      break;
+    }
+    m_sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_ring[m_tail & (RING_SIZE - 1)].sequence.load() != m_tail + 1 &&
+        !m_stopping) {
+      uint64_t count;
+      read(m_wake_fd, &count, sizeof(count));
+    }
+    m_sleeping = false;
+  }
+}
+
+bool G13_AsyncAppender::Write(const log4cpp::LoggingEvent &event) {
+  std::string line = _getLayout().format(event);
+  const char *data = line.data();
+  size_t left = line.size();
+  while (left > 0) {
+    ssize_t written = write(m_fd, data, left);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    left -= written;
+  }
+  return true;
+}
+
+} // namespace G13
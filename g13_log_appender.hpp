@@ -0,0 +1,69 @@
+/* This file contains the log4cpp appender g13d logs through
+ *
+ */
+
+#ifndef G13_G13_LOG_APPENDER_HPP
+#define G13_G13_LOG_APPENDER_HPP
+
+#include <atomic>
+#include <log4cpp/LayoutAppender.hh>
+#include <string>
+#include <thread>
+
+namespace G13 {
+
+/*!
+ * appender that never blocks the thread logging
+ *
+ * Records are copied into a bounded lock-free ring and formatted and written
+ * by a background thread. When the writer falls behind, say on a slow
+ * terminal or journald pipe, records are dropped and the number of drops is
+ * logged once the ring has room again. The rare message too long for a slot,
+ * such as the symbol list of DisplayKeys, is copied to the heap instead.
+ */
+class G13_AsyncAppender : public log4cpp::LayoutAppender {
+public:
+  // takes ownership of fd
+  G13_AsyncAppender(const std::string &name, int fd);
+  ~G13_AsyncAppender() override;
+
+  // writes out what is queued and stops the background thread
+  void close() override;
+
+  [[nodiscard]] unsigned long dropped() const { return m_dropped_total; }
+
+protected:
+  static constexpr size_t RING_SIZE = 1024; // a power of two
+  static constexpr size_t MESSAGE_SIZE = 224;
+
+  struct Record {
+    std::atomic<size_t> sequence;
+    std::string *spill; // the message when longer than MESSAGE_SIZE
+    int priority;
+    unsigned seconds;
+    unsigned microseconds;
+    unsigned short length;
+    char message[MESSAGE_SIZE];
+  };
+
+  void _append(const log4cpp::LoggingEvent &event) override;
+
+  void Run();
+  bool Write(const log4cpp::LoggingEvent &event);
+
+  Record m_ring[RING_SIZE];
+  std::atomic<size_t> m_head{0}; // next slot to fill
+  size_t m_tail = 0;             // next slot to write, writer thread only
+  std::atomic<unsigned long> m_dropped{0};
+  std::atomic<unsigned long> m_dropped_total{0};
+
+  int m_fd;
+  int m_wake_fd;
+  std::atomic<bool> m_sleeping{false};
+  std::atomic<bool> m_stopping{false};
+  std::thread m_thread;
+};
+
+} // namespace G13
+
+#endif // G13_G13_LOG_APPENDER_HPP
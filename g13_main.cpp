@@ -20,26 +20,37 @@ void printHelp() {
               << "specify name for output pipe" << std::endl;
     std::cout << std::left << std::setw(indent) << "  --log_level <level>"
               << "logging level" << std::endl;
-//    std::cout << std::left << std::setw(indent) << "--log_file <file>"
-//              << "write log to logfile" << std::endl;
+    std::cout << std::left << std::setw(indent) << "  --key_transfers <n>"
+              << "number of key reports kept in flight" << std::endl;
+    std::cout << std::left << std::setw(indent) << "  --profile_cache <n>"
+              << "profiles from the config kept made" << std::endl;
+    std::cout << std::left << std::setw(indent) << "  --reconnect <s>"
+              << "seconds an unplugged G13 keeps its state" << std::endl;
+    std::cout << std::left << std::setw(indent) << "  --socket <name>"
+              << "specify name for control socket" << std::endl;
+    std::cout << std::left << std::setw(indent) << "  --socket_mode <mode>"
+              << "octal permissions of the control socket" << std::endl;
+    std::cout << std::left << std::setw(indent) << "  --log_file <file>"
+              << "write log to logfile" << std::endl;
     exit(1);
 }
 
 int main(int argc, char* argv[]) {
 
-    G13_Manager::Instance()->start_logging();
-  G13_Manager::Instance()->SetLogLevel("INFO");
-    G13_OUT("g13d v" << GIT_VERSION << " " << __DATE__ << " " << __TIME__);
-
     // TODO: move out argument parsing
-    const char* const short_opts = "l:c:i:o:d:h";
+    const char* const short_opts = "l:c:i:o:d:k:p:r:s:m:f:h";
     const option long_opts[] = {
         {"logo", required_argument, nullptr, 'l'},
         {"config", required_argument, nullptr, 'c'},
         {"pipe_in", required_argument, nullptr, 'i'},
         {"pipe_out", required_argument, nullptr, 'o'},
         {"log_level", required_argument, nullptr, 'd'},
-        //                                {"log_file", required_argument, nullptr, 'f'},
+        {"key_transfers", required_argument, nullptr, 'k'},
+        {"profile_cache", required_argument, nullptr, 'p'},
+        {"reconnect", required_argument, nullptr, 'r'},
+        {"socket", required_argument, nullptr, 's'},
+        {"socket_mode", required_argument, nullptr, 'm'},
+        {"log_file", required_argument, nullptr, 'f'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, no_argument, nullptr, 0}};
     while (true) {
@@ -69,8 +80,30 @@ int main(int argc, char* argv[]) {
 
             case 'd':
               G13_Manager::Instance()->setStringConfigValue("log_level", std::string(optarg));
-            G13_Manager::Instance()->SetLogLevel(
-                G13_Manager::Instance()->getStringConfigValue("log_level"));
+                break;
+
+            case 'f':
+              G13_Manager::Instance()->setStringConfigValue("log_file", std::string(optarg));
+                break;
+
+            case 'k':
+              G13_Manager::Instance()->setStringConfigValue("key_transfers", std::string(optarg));
+                break;
+
+            case 'p':
+              G13_Manager::Instance()->setStringConfigValue("profile_cache", std::string(optarg));
+                break;
+
+            case 'r':
+              G13_Manager::Instance()->setStringConfigValue("reconnect", std::string(optarg));
+                break;
+
+            case 's':
+              G13_Manager::Instance()->setStringConfigValue("socket", std::string(optarg));
+                break;
+
+            case 'm':
+              G13_Manager::Instance()->setStringConfigValue("socket_mode", std::string(optarg));
                 break;
 
             case 'h':  // -h or --help
@@ -80,5 +113,18 @@ int main(int argc, char* argv[]) {
                 break;
         }
     }
-    return G13_Manager::Instance()->Run();
+
+    // logging starts once the options say where to
+    G13_Manager::Instance()->start_logging(
+        G13_Manager::Instance()->getStringConfigValue("log_file"));
+    G13_Manager::Instance()->SetLogLevel("INFO");
+    G13_OUT("g13d v" << GIT_VERSION << " " << __DATE__ << " " << __TIME__);
+    auto log_level = G13_Manager::Instance()->getStringConfigValue("log_level");
+    if (!log_level.empty()) {
+        G13_Manager::Instance()->SetLogLevel(log_level);
+    }
+
+    auto result = G13_Manager::Instance()->Run();
+    G13_Manager::Instance()->stop_logging();
+    return result;
 }
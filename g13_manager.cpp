@@ -6,8 +6,12 @@
 #include "g13_device.hpp"
 #include "g13_keys.hpp"
 #include "helper.hpp"
+#include <algorithm>
 #include <csignal>
-#include <libevdev-1.0/libevdev/libevdev.h>
+#include <poll.h>
+#include <set>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <log4cpp/OstreamAppender.hh>
 #include <memory>
 
@@ -18,84 +22,257 @@ bool G13_Manager::running = true;
 std::map<std::string, std::string> G13_Manager::stringConfigValues;
 libusb_context *G13_Manager::libusbContext;
 std::vector<G13::G13_Device *> G13_Manager::g13s;
+std::vector<G13::G13_Device *> G13_Manager::g13s_closing;
+std::vector<G13::G13_Device *> G13_Manager::g13s_pending;
+std::vector<G13::G13_Device *> G13_Manager::g13s_parking;
+std::map<std::string, G13_Manager::ParkedDevice> G13_Manager::g13s_parked;
+std::map<std::string, G13_Manager::ReturningDevice>
+    G13_Manager::g13s_returning;
+G13_Reactor G13_Manager::reactor;
+int G13_Manager::usb_timer_fd = -1;
+G13_ControlServer G13_Manager::control_server;
 libusb_hotplug_callback_handle G13_Manager::hotplug_cb_handle[3];
 const int G13_Manager::class_id = LIBUSB_HOTPLUG_MATCH_ANY;
 
-std::map<G13_KEY_INDEX, std::string> G13_Manager::g13_key_to_name;
-std::map<std::string, G13_KEY_INDEX> G13_Manager::g13_name_to_key;
-std::map<LINUX_KEY_VALUE, std::string> G13_Manager::input_key_to_name;
-std::map<std::string, LINUX_KEY_VALUE> G13_Manager::input_name_to_key;
 
 libusb_device **G13_Manager::devs;
 std::string G13_Manager::logoFilename;
+std::shared_ptr<const G13_Config> G13_Manager::config;
+int G13_Manager::config_watch_fd = -1;
+std::set<std::pair<int, std::string>> G13_Manager::config_watched;
+int G13_Manager::config_reload_timer = -1;
 
 G13_Manager::G13_Manager() /* : libusbContext(nullptr), devs(nullptr)*/ {
-  InitKeynames();
 }
 
 void G13_Manager::Cleanup() {
   G13_OUT("Cleaning up");
+  control_server.Close();
+  config = nullptr;
+  WatchConfig();
+  if (config_reload_timer >= 0) {
+    reactor.RemoveTimer(config_reload_timer);
+    config_reload_timer = -1;
+  }
   for (auto handle : hotplug_cb_handle) {
     libusb_hotplug_deregister_callback(libusbContext, handle);
   }
-  // TODO: This might be better with an iterator and also g13s.erase(iter)
-  for (auto g13 : g13s) {
-
-    // g13->Cleanup();
+  while (!g13s.empty()) {
+    CloseDevice(g13s.back());
+  }
+  g13s_closing.insert(g13s_closing.end(), g13s_parking.begin(),
+                      g13s_parking.end());
+  g13s_parking.clear();
+  while (!g13s_parked.empty()) {
+    delete Unpark(g13s_parked.begin()->first);
+  }
+  while (!g13s_returning.empty()) {
+    DropReturning(g13s_returning.begin()->first);
+  }
+  // give libusb a chance to deliver the cancelled transfers
+  for (int i = 0; i < 10 && !g13s_closing.empty(); i++) {
+    HandleUsbEvents(100);
+    ReapClosedDevices();
+  }
+  for (auto g13 : g13s_closing) {
+    G13_ERR("Transfers still pending, closing device anyway");
     delete g13;
   }
+  g13s_closing.clear();
   libusb_exit(libusbContext);
 }
 
-void G13_Manager::InitKeynames() {
+/*! takes a device out of service
+ *
+ * Its transfers are cancelled right away but the object itself lives on in
+ * g13s_closing until libusb has called back for every one of them. An
+ * unplugged device goes to g13s_parking instead, unless the reconnect
+ * config value is 0.
+ */
+void G13_Manager::CloseDevice(G13::G13_Device *g13, bool park) {
+  g13s.erase(std::remove(g13s.begin(), g13s.end(), g13), g13s.end());
+  g13s_pending.erase(std::remove(g13s_pending.begin(), g13s_pending.end(), g13),
+                     g13s_pending.end());
+  g13->CancelTransfers();
+  if (park && g13->registered() && ReconnectSeconds() > 0) {
+    g13s_parking.push_back(g13);
+  } else {
+    g13s_closing.push_back(g13);
+  }
+}
+
+void G13_Manager::ReapClosedDevices() {
+  for (auto iter = g13s_closing.begin(); iter != g13s_closing.end();) {
+    if ((*iter)->TransfersPending()) {
+      iter++;
+    } else {
+      delete *iter;
+      iter = g13s_closing.erase(iter);
+    }
+  }
+  for (auto iter = g13s_parking.begin(); iter != g13s_parking.end();) {
+    if ((*iter)->TransfersPending()) {
+      iter++;
+    } else {
+      auto port_path = (*iter)->port_path();
+      ParkDevice(*iter);
+      iter = g13s_parking.erase(iter);
+      auto returning = g13s_returning.find(port_path);
+      if (returning != g13s_returning.end()) {
+        auto back = returning->second;
+        g13s_returning.erase(returning);
+        AddG13(back.dev, back.handle);
+      }
+    }
+  }
+}
 
-  int key_index = 0;
+/*! keeps an unplugged device, all but its USB side, for when it comes back
+ *
+ * A G13 showing up on the same port within the reconnect time takes it over
+ * in OpenAndAddG13(), with its profiles, stick calibration, LCD contents,
+ * backlight, uinput device and pipes as they were, so a flaky cable or a hub
+ * reset goes unnoticed. Otherwise it is deleted when the timer runs out.
+ */
+void G13_Manager::ParkDevice(G13::G13_Device *g13) {
+  g13->Detach();
+  std::string port_path = g13->port_path();
+  delete Unpark(port_path);
+  int timer = reactor.AddTimer([port_path] {
+    G13_OUT("Device on port " << port_path << " did not come back");
+    delete Unpark(port_path);
+  });
+  G13_Reactor::ArmTimer(timer, ReconnectSeconds() * 1000000L);
+  g13s_parked[port_path] = {g13, timer};
+  G13_OUT("Keeping device " << g13->id_within_manager() << " from port "
+                            << port_path << " for " << ReconnectSeconds()
+                            << "s");
+}
 
-  // setup maps to let us convert between strings and G13 key names
-  for (auto &name : G13::G13_KEY_STRINGS) {
-    g13_key_to_name[key_index] = name;
-    g13_name_to_key[name] = key_index;
-    G13_DBG("mapping G13 " << name << " = " << key_index);
-    key_index++;
+// takes the device parked for port_path back, nullptr if there is none
+G13::G13_Device *G13_Manager::Unpark(const std::string &port_path) {
+  auto iter = g13s_parked.find(port_path);
+  if (iter == g13s_parked.end()) {
+    return nullptr;
   }
+  auto g13 = iter->second.g13;
+  reactor.RemoveTimer(iter->second.timer);
+  g13s_parked.erase(iter);
+  return g13;
+}
 
-  // setup maps to let us convert between strings and linux key names
-  for (auto &symbol : G13::G13_SYMBOLS) {
-    auto keyname = std::string("KEY_" + std::string(symbol));
+// closes the handle of a device waiting for its old one to be parked
+void G13_Manager::DropReturning(const std::string &port_path) {
+  auto iter = g13s_returning.find(port_path);
+  if (iter == g13s_returning.end()) {
+    return;
+  }
+  libusb_release_interface(iter->second.handle, 0);
+  libusb_close(iter->second.handle);
+  g13s_returning.erase(iter);
+}
 
-    int code = libevdev_event_code_from_name(EV_KEY, keyname.c_str());
-    if (code < 0) {
-      G13_ERR("No input event code found for " << keyname);
-    } else {
-      // TODO: this seems to map ok but the result is off
-      // assert(keyname.compare(libevdev_event_code_get_name(EV_KEY,code)) ==
-      // 0); linux/input-event-codes.h
+// seconds an unplugged device is kept, from the reconnect config value
+long G13_Manager::ReconnectSeconds() {
+  std::string configured = getStringConfigValue("reconnect");
+  return configured.empty() ? G13_RECONNECT_SECONDS
+                            : std::max(0L, atol(configured.c_str()));
+}
 
-      input_key_to_name[code] = symbol;
-      input_name_to_key[symbol] = code;
-      G13_DBG("mapping " << symbol << " " << keyname << "=" << code);
+/*! the lowest id no device uses, parked and closing ones included, as the
+ * id names the pipes they still hold
+ */
+int G13_Manager::NextDeviceId() {
+  std::set<int> used;
+  for (auto list : {&g13s, &g13s_closing, &g13s_parking}) {
+    for (auto g13 : *list) {
+      used.insert(g13->id_within_manager());
     }
   }
+  for (auto &parked : g13s_parked) {
+    used.insert(parked.second.g13->id_within_manager());
+  }
+  int id = 0;
+  while (used.count(id)) {
+    id++;
+  }
+  return id;
+}
 
-  // setup maps to let us convert between strings and linux button names
-  for (auto &symbol : G13::G13_BTN_SEQ) {
-    auto name = std::string("M" + std::string(symbol));
-    auto keyname = std::string("BTN_" + std::string(symbol));
-    int code = libevdev_event_code_from_name(EV_KEY, keyname.c_str());
-    if (code < 0) {
-      G13_ERR("No input event code found for " << keyname);
-    } else {
-      input_key_to_name[code] = name;
-      input_name_to_key[name] = code;
-      G13_DBG("mapping " << name << " " << keyname << "=" << code);
+void G13_Manager::HandleUsbEvents(int timeout_ms) {
+  struct timeval tv {};
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  int error =
+      libusb_handle_events_timeout_completed(libusbContext, &tv, nullptr);
+  if (error != LIBUSB_SUCCESS && error != LIBUSB_ERROR_INTERRUPTED) {
+    G13_ERR("Error: " << G13_Device::DescribeLibusbErrorCode(error));
+  }
+  UpdateUsbTimer();
+}
+
+/*! hands libusb's file descriptors over to the reactor
+ *
+ * libusb tells us through the pollfd notifiers whenever it opens or closes
+ * one, and if it can not handle its timeouts through those descriptors
+ * itself a timerfd is kept armed for the next one.
+ */
+void G13_Manager::WatchUsbEvents() {
+  libusb_set_pollfd_notifiers(libusbContext, UsbPollfdAdded, UsbPollfdRemoved,
+                              nullptr);
+  const libusb_pollfd **pollfds = libusb_get_pollfds(libusbContext);
+  if (pollfds) {
+    for (int i = 0; pollfds[i]; i++) {
+      UsbPollfdAdded(pollfds[i]->fd, pollfds[i]->events, nullptr);
     }
+    libusb_free_pollfds(pollfds);
+  }
+  if (!libusb_pollfds_handle_timeouts(libusbContext)) {
+    usb_timer_fd = reactor.AddTimer([] { HandleUsbEvents(0); });
+  }
+}
+
+void G13_Manager::UpdateUsbTimer() {
+  if (usb_timer_fd < 0) {
+    return;
+  }
+  struct timeval tv {};
+  if (libusb_get_next_timeout(libusbContext, &tv) == 1) {
+    G13_Reactor::ArmTimer(usb_timer_fd, tv.tv_sec * 1000000 + tv.tv_usec);
+  }
+}
+
+void LIBUSB_CALL G13_Manager::UsbPollfdAdded(int fd, short events,
+                                             void *user_data) {
+  uint32_t epoll_events = 0;
+  if (events & POLLIN) {
+    epoll_events |= EPOLLIN;
+  }
+  if (events & POLLOUT) {
+    epoll_events |= EPOLLOUT;
+  }
+  reactor.Watch(fd, epoll_events, [](uint32_t) { HandleUsbEvents(0); });
+}
+
+void LIBUSB_CALL G13_Manager::UsbPollfdRemoved(int fd, void *user_data) {
+  reactor.Unwatch(fd);
+}
+
+/*! finishes devices opened from a hotplug callback
+ *
+ * This can not be done from the event handler (will give LIBUSB_ERROR_BUSY)
+ */
+void G13_Manager::SetupPendingDevices() {
+  while (!g13s_pending.empty()) {
+    auto g13 = g13s_pending.front();
+    g13s_pending.erase(g13s_pending.begin());
+    SetupDevice(g13);
   }
 }
 
 void G13_Manager::SignalHandler(int signal) {
   G13_OUT("Caught signal " << signal << " (" << strsignal(signal) << ")");
   running = false;
-  // TODO: Should we break usblib handling with a reset?
 }
 
 std::string G13_Manager::getStringConfigValue(const std::string &name) {
@@ -112,6 +289,31 @@ void G13_Manager::setStringConfigValue(const std::string &name,
   stringConfigValues[name] = value;
 }
 
+std::string G13_Manager::MakeSocketName() {
+  std::string config_socket = getStringConfigValue("socket");
+  if (!config_socket.empty()) {
+    return config_socket;
+  }
+  return CONTROL_DIR + "g13d.sock";
+}
+
+// permissions of the control socket, from the octal socket_mode config value
+mode_t G13_Manager::SocketMode() {
+  std::string configured = getStringConfigValue("socket_mode");
+  return configured.empty()
+             ? G13_SOCKET_MODE
+             : static_cast<mode_t>(strtol(configured.c_str(), nullptr, 8));
+}
+
+G13::G13_Device *G13_Manager::FindDevice(int id) {
+  for (auto g13 : g13s) {
+    if (g13->id_within_manager() == id) {
+      return g13;
+    }
+  }
+  return nullptr;
+}
+
 std::string G13_Manager::MakePipeName(G13::G13_Device *d, bool is_input) {
   if (is_input) {
     std::string config_base = getStringConfigValue("pipe_in");
@@ -138,51 +340,116 @@ std::string G13_Manager::MakePipeName(G13::G13_Device *d, bool is_input) {
   }
 }
 
-G13::LINUX_KEY_VALUE G13_Manager::FindG13KeyValue(const std::string &keyname) {
-  auto i = g13_name_to_key.find(keyname);
-  if (i == g13_name_to_key.end()) {
-    return G13::BAD_KEY_VALUE;
+// *************************************************************************
+// key name tables, all worked out by the compiler
+
+static constexpr size_t G13_SYMBOL_COUNT =
+    sizeof(G13_SYMBOLS) / sizeof(*G13_SYMBOLS);
+
+static_assert(sizeof(G13_KEY_STRINGS) / sizeof(*G13_KEY_STRINGS) ==
+              G13_NUM_KEYS);
+
+static constexpr Helper::PerfectHash<G13_NUM_KEYS> g13_key_hash([] {
+  std::array<std::string_view, G13_NUM_KEYS> names{};
+  for (size_t i = 0; i < G13_NUM_KEYS; i++) {
+    names[i] = G13_KEY_STRINGS[i];
   }
-  return i->second;
-}
+  return names;
+}());
 
-G13::LINUX_KEY_VALUE
-G13_Manager::FindInputKeyValue(const std::string &keyname) {
-  // if there is a KEY_ prefix, strip it off
-  if (!strncmp(keyname.c_str(), "KEY_", 4)) {
-    return FindInputKeyValue(keyname.c_str() + 4);
+static constexpr Helper::PerfectHash<G13_SYMBOL_COUNT> input_key_hash([] {
+  std::array<std::string_view, G13_SYMBOL_COUNT> names{};
+  for (size_t i = 0; i < G13_SYMBOL_COUNT; i++) {
+    names[i] = G13_SYMBOLS[i].name;
+  }
+  return names;
+}());
+
+// indexed by code, the first name given for a code wins over its aliases
+static constexpr auto input_key_names = [] {
+  std::array<const char *, KEY_CNT> names{};
+  for (auto &symbol : G13_SYMBOLS) {
+    if (!(symbol.code & G13_REL_FLAG) && !names[symbol.code]) {
+      names[symbol.code] = symbol.name;
+    }
   }
+  return names;
+}();
+
+static constexpr auto input_rel_names = [] {
+  std::array<const char *, REL_CNT> names{};
+  for (auto &symbol : G13_SYMBOLS) {
+    if (symbol.code & G13_REL_FLAG && !names[symbol.code & ~G13_REL_FLAG]) {
+      names[symbol.code & ~G13_REL_FLAG] = symbol.name;
+    }
+  }
+  return names;
+}();
 
-  auto i = input_name_to_key.find(keyname);
-  if (i == input_name_to_key.end()) {
-    return G13::BAD_KEY_VALUE;
+static_assert(g13_key_hash.find("G22") == 21);
+static_assert(G13_SYMBOLS[input_key_hash.find("MLEFT")].code == BTN_LEFT);
+static_assert(G13_SYMBOLS[input_key_hash.find("MFORWARD")].code == BTN_FORWARD);
+static_assert(G13_SYMBOLS[input_key_hash.find("REL_WHEEL")].code ==
+              (G13_REL_FLAG | REL_WHEEL));
+
+G13::LINUX_KEY_VALUE G13_Manager::FindG13KeyValue(std::string_view keyname) {
+  return g13_key_hash.find(keyname);
+}
+
+/*! accepts the names in G13_SYMBOLS, as well as keys and buttons by their
+ * full KEY_xxx or BTN_xxx name
+ */
+G13::LINUX_KEY_VALUE G13_Manager::FindInputKeyValue(std::string_view keyname) {
+  int index = -1;
+  if (keyname.substr(0, 4) == "BTN_") {
+    char name[32] = "M";
+    if (keyname.size() - 4 < sizeof(name) - 1) {
+      keyname.copy(name + 1, keyname.size() - 4, 4);
+      index = input_key_hash.find(std::string_view(name, keyname.size() - 3));
+    }
+  } else {
+    if (keyname.substr(0, 4) == "KEY_") {
+      keyname.remove_prefix(4);
+    }
+    index = input_key_hash.find(keyname);
   }
-  return i->second;
+  return index < 0 ? G13::BAD_KEY_VALUE : G13_SYMBOLS[index].code;
 }
 
 std::string G13_Manager::FindInputKeyName(G13::LINUX_KEY_VALUE v) {
-  try {
-    return Helper::find_or_throw(input_key_to_name, v);
-  } catch (...) {
-    return "(unknown linux key)";
+  if (v & G13_REL_FLAG) {
+    std::string sign = v & G13_REL_NEGATIVE ? "-" : "";
+    v &= ~(G13_REL_FLAG | G13_REL_NEGATIVE);
+    if (v >= 0 && v < REL_CNT && input_rel_names[v]) {
+      return sign + input_rel_names[v];
+    }
+  } else if (v >= 0 && v < KEY_CNT && input_key_names[v]) {
+    return input_key_names[v];
   }
+  return "(unknown linux key)";
 }
 
 std::string G13_Manager::FindG13KeyName(G13::G13_KEY_INDEX v) {
-  try {
-    return Helper::find_or_throw(g13_key_to_name, v);
-  } catch (...) {
-    return "(unknown G13 key)";
+  if (v >= 0 && static_cast<size_t>(v) < G13_NUM_KEYS) {
+    return G13_KEY_STRINGS[v];
   }
+  return "(unknown G13 key)";
 }
 
 void G13_Manager::DisplayKeys() {
-  typedef std::map<std::string, int> mapType;
+  std::string names;
+  for (auto &name : G13_KEY_STRINGS) {
+    names += std::string(names.empty() ? "" : " ") + name;
+  }
   G13_OUT("Known keys on G13:");
-  G13_OUT(Helper::map_keys_out(g13_name_to_key));
+  G13_OUT(names);
 
+  names.clear();
+  for (auto &symbol : G13_SYMBOLS) {
+    names += std::string(names.empty() ? "" : " ") + symbol.name;
+  }
   G13_OUT("Known keys to map to:");
-  G13_OUT(Helper::map_keys_out(input_name_to_key));
+  G13_OUT(names);
 }
 
 int G13_Manager::Run() {
@@ -220,43 +487,40 @@ int G13_Manager::Run() {
     ArmHotplugCallbacks();
   }
 
-  signal(SIGINT, SignalHandler);
-  signal(SIGTERM, SignalHandler);
-
-  for (auto g13 : g13s) {
-    // This can not be done from the event handler (will give LIBUSB_ERROR_BUSY)
-    SetupDevice(g13);
+  if (!reactor.WatchSignals({SIGINT, SIGTERM}, SignalHandler)) {
+    signal(SIGINT, SignalHandler);
+    signal(SIGTERM, SignalHandler);
   }
-
-  do {
-    if (g13s.empty()) {
+  WatchUsbEvents();
+  control_server.Listen(MakeSocketName(), SocketMode());
+
+  bool waiting = false;
+  while (running) {
+    // reaping may hand a replugged device back to g13s_pending
+    ReapClosedDevices();
+    SetupPendingDevices();
+    if (g13s.empty() && !waiting) {
       G13_OUT("Waiting for device to show up ...");
-      error = libusb_handle_events(libusbContext);
-      G13_DBG("USB Event wakeup with " << g13s.size() << " devices registered");
-      if (error != LIBUSB_SUCCESS) {
-        G13_ERR("Error: " << G13_Device::DescribeLibusbErrorCode(error));
-      } else {
-        for (auto g13 : g13s) {
-          // This can not be done from the event handler (will give
-          // LIBUSB_ERROR_BUSY)
-          SetupDevice(g13);
-        }
-      }
     }
+    waiting = g13s.empty();
 
-    // Main loop
+    // devices without an asynchronous key transfer still have to be polled
+    bool poll_keys = false;
     for (auto g13 : g13s) {
-      int status = g13->ReadKeypresses();
-      if (!g13s.empty()) {
-        // Cleanup might have removed the object before this loop has run
-        // TODO: This will not work with multiplt devices and can be better
-        g13->ReadCommandsFromPipe();
-      };
-      if (status < 0) {
-        running = false;
+      poll_keys |= !g13->async_keys();
+    }
+
+    reactor.Poll(poll_keys ? 0 : -1);
+
+    if (poll_keys) {
+      // iterating a copy as USB event handling may close devices
+      for (auto g13 : std::vector<G13_Device *>(g13s)) {
+        if (!g13->async_keys() && g13->ReadKeypresses() < 0) {
+          running = false;
+        }
       }
     }
-  } while (running);
+  }
 
   Cleanup();
   G13_OUT("Exit");
@@ -283,4 +547,115 @@ void G13_Manager::setLogoFilename(const std::string &newLogoFilename) {
   logoFilename = newLogoFilename;
 }
 
+/*! the configuration named by the "config" value, loaded on first use and
+ * shared by every device plugged in after, see ReloadConfig() for changes
+ */
+std::shared_ptr<const G13_Config> G13_Manager::Config() {
+  std::string config_fn = getStringConfigValue("config");
+  if (config_fn.empty()) {
+    return nullptr;
+  }
+  if (!config || config->filename() != config_fn) {
+    config = G13_Config::Load(config_fn);
+    WatchConfig();
+  } else {
+    ReloadConfig();
+  }
+  return config;
+}
+
+/*! reads the configuration again if any of its files changed, and moves
+ * every device that applied it over to the new one
+ *
+ * A configuration that can not be read leaves the old one in place.
+ */
+void G13_Manager::ReloadConfig() {
+  if (!config || !config->Stale()) {
+    return;
+  }
+  auto loaded = G13_Config::Load(config->filename());
+  if (!loaded) {
+    G13_ERR("Keeping the configuration read before");
+    return;
+  }
+  for (auto list : {&g13s, &g13s_parking}) {
+    for (auto g13 : *list) {
+      g13->ReloadConfig(config, loaded);
+    }
+  }
+  for (auto &parked : g13s_parked) {
+    parked.second.g13->ReloadConfig(config, loaded);
+  }
+  config = loaded;
+  WatchConfig();
+}
+
+/*! watches the directories the configuration was read from
+ *
+ * Directories rather than files, as editors often save by writing a new
+ * file and renaming it over the old one. Changes are picked up once they
+ * have settled, see G13_CONFIG_SETTLE_US.
+ */
+void G13_Manager::WatchConfig() {
+  if (config_watch_fd >= 0) {
+    reactor.Unwatch(config_watch_fd);
+    close(config_watch_fd);
+    config_watch_fd = -1;
+  }
+  config_watched.clear();
+  if (!config) {
+    return;
+  }
+  config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (config_watch_fd < 0) {
+    G13_ERR("Could not watch the configuration: " << strerror(errno));
+    return;
+  }
+  for (auto &file : config->files()) {
+    auto slash = file.rfind('/');
+    std::string dir = slash == std::string::npos ? "."
+                      : slash == 0               ? "/"
+                                                 : file.substr(0, slash);
+    // a directory watched already just gives the same watch back
+    int watch = inotify_add_watch(config_watch_fd, dir.c_str(),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch < 0) {
+      G13_ERR("Could not watch " << dir << ": " << strerror(errno));
+      continue;
+    }
+    config_watched.emplace(watch, file.substr(slash + 1));
+  }
+  if (config_reload_timer < 0) {
+    config_reload_timer = reactor.AddTimer(ReloadConfig);
+  }
+  reactor.Watch(config_watch_fd, EPOLLIN, [](uint32_t) { ConfigChanged(); });
+}
+
+/*! arms the reload timer if any of the events is about a configuration file
+ *
+ * Files are told apart by the watch of their directory as well as by name,
+ * a file of the same name in another watched directory is not one of them.
+ */
+void G13_Manager::ConfigChanged() {
+  alignas(struct inotify_event) char buffer[4096];
+  bool relevant = false;
+  ssize_t size;
+  while ((size = read(config_watch_fd, buffer, sizeof(buffer))) > 0) {
+    for (char *p = buffer; p < buffer + size;) {
+      auto event = reinterpret_cast<const struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        relevant = true;
+        continue;
+      }
+      relevant |= event->len &&
+                  config_watched.count({event->wd, event->name}) > 0;
+    }
+  }
+  if (relevant) {
+    // every further change starts the wait over
+    G13_Reactor::ArmTimer(config_reload_timer, G13_CONFIG_SETTLE_US);
+  }
+}
+
 } // namespace G13
\ No newline at end of file
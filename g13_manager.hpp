@@ -7,11 +7,15 @@
 
 #include "g13.hpp"
 #include "g13_action.hpp"
+#include "g13_config.hpp"
+#include "g13_control.hpp"
 #include "g13_device.hpp"
 #include "g13_keys.hpp"
 #include "g13_log.hpp"
 #include "g13_manager.hpp"
+#include "g13_reactor.hpp"
 #include <libusb-1.0/libusb.h>
+#include <set>
 
 #define CONTROL_DIR std::string("/tmp/")
 
@@ -19,6 +23,15 @@
  * top level class, holds what would otherwise be in global variables
  */
 namespace G13 {
+
+// default of the reconnect config value
+const long G13_RECONNECT_SECONDS = 30;
+// default of the socket_mode config value, only the user g13d runs as
+const mode_t G13_SOCKET_MODE = 0600;
+// how long the configuration has to be left alone before it is read again,
+// editors tend to save in more than one step
+const long G13_CONFIG_SETTLE_US = 100000;
+
 class G13_Manager {
 private:
   G13_Manager();
@@ -28,14 +41,33 @@ private:
   static std::map<std::string, std::string> stringConfigValues;
   static libusb_context *libusbContext;
   static std::vector<G13::G13_Device *> g13s;
+  static std::vector<G13::G13_Device *> g13s_closing;
+  static std::vector<G13::G13_Device *> g13s_pending;
+  // unplugged devices, parked once their transfers have called back
+  static std::vector<G13::G13_Device *> g13s_parking;
+  struct ParkedDevice {
+    G13::G13_Device *g13;
+    int timer; // deletes it if it does not come back in time
+  };
+  static std::map<std::string, ParkedDevice> g13s_parked; // by port path
+  // replugged while their old device was still parking, by port path
+  struct ReturningDevice {
+    libusb_device *dev;
+    libusb_device_handle *handle;
+  };
+  static std::map<std::string, ReturningDevice> g13s_returning;
+  static G13_Reactor reactor;
+  static int usb_timer_fd;
+  static G13_ControlServer control_server;
   static libusb_hotplug_callback_handle hotplug_cb_handle[3];
-  static std::map<G13_KEY_INDEX, std::string> g13_key_to_name;
-  static std::map<std::string, G13_KEY_INDEX> g13_name_to_key;
-  static std::map<LINUX_KEY_VALUE, std::string> input_key_to_name;
-  static std::map<std::string, LINUX_KEY_VALUE> input_name_to_key;
   static libusb_device **devs;
   static std::string logoFilename;
   static const int class_id;
+  static std::shared_ptr<const G13_Config> config;
+  static int config_watch_fd; // inotify on the directories of its files
+  // watch descriptor of its directory and name of every file
+  static std::set<std::pair<int, std::string>> config_watched;
+  static int config_reload_timer;
 
 public:
   static G13_Manager *
@@ -44,26 +76,42 @@ public:
   // static const std::string &getLogoFilename();
   static void setLogoFilename(const std::string &logoFilename);
 
-  [[nodiscard]] static int FindG13KeyValue(const std::string &keyname);
+  [[nodiscard]] static int FindG13KeyValue(std::string_view keyname);
 
   [[nodiscard]] static std::string FindG13KeyName(int v);
 
   [[nodiscard]] static G13::LINUX_KEY_VALUE
-  FindInputKeyValue(const std::string &keyname);
+  FindInputKeyValue(std::string_view keyname);
 
   [[nodiscard]] static std::string FindInputKeyName(G13::LINUX_KEY_VALUE v);
 
   static int Run();
 
+  static G13_Reactor &Reactor() { return reactor; }
+
   [[nodiscard]] static std::string
   getStringConfigValue(const std::string &name);
 
   static void setStringConfigValue(const std::string &name,
                                    const std::string &value);
 
+  static std::string MakeSocketName();
+
+  static mode_t SocketMode();
+
+  // the parsed configuration file, nullptr if there is none
+  static std::shared_ptr<const G13_Config> Config();
+
+  static void ReloadConfig();
+
+  // the open device with the given id, nullptr if there is none
+  [[nodiscard]] static G13::G13_Device *FindDevice(int id);
+
   static std::string MakePipeName(G13::G13_Device *d, bool is_input);
 
-  static void start_logging();
+  static void start_logging(const std::string &log_file = "");
+
+  static void stop_logging();
 
   [[maybe_unused]] static void
   SetLogLevel(log4cpp::Priority::PriorityLevel lvl);
@@ -71,18 +119,46 @@ public:
   static void SetLogLevel(const std::string &level);
 
 protected:
-  static void InitKeynames();
-
   static void DisplayKeys();
 
   static void DiscoverG13s(libusb_device **devs, ssize_t count);
 
   static void Cleanup();
 
+  static void CloseDevice(G13::G13_Device *g13, bool park = false);
+
+  static void ReapClosedDevices();
+
+  static void ParkDevice(G13::G13_Device *g13);
+
+  static G13::G13_Device *Unpark(const std::string &port_path);
+
+  static void DropReturning(const std::string &port_path);
+
+  static int NextDeviceId();
+
+  static long ReconnectSeconds();
+
+  static void HandleUsbEvents(int timeout_ms);
+
+  static void WatchUsbEvents();
+
+  static void UpdateUsbTimer();
+
+  static void LIBUSB_CALL UsbPollfdAdded(int fd, short events, void *user_data);
+
+  static void LIBUSB_CALL UsbPollfdRemoved(int fd, void *user_data);
+
+  static void SetupPendingDevices();
+
   static void SignalHandler(int);
 
   static void SetupDevice(G13::G13_Device *g13);
 
+  static void WatchConfig();
+
+  static void ConfigChanged();
+
   static int LIBUSB_CALL HotplugCallbackEnumerate(struct libusb_context *ctx,
                                                   struct libusb_device *dev,
                                                   libusb_hotplug_event event,
@@ -100,6 +176,8 @@ protected:
 
   static int OpenAndAddG13(libusb_device *dev);
 
+  static void AddG13(libusb_device *dev, libusb_device_handle *handle);
+
   static void ArmHotplugCallbacks();
 };
 } // namespace G13
@@ -16,49 +16,59 @@ G13_Manager *G13_Manager::Instance() // Singleton
   return mInstance;
 }
 
-void G13_Profile::_init_keys() {
-  // create a G13_Key entry for every key in G13_KEY_SEQ
-  int key_index = 0;
-  // std::string str = G13_KEY_STRINGS[0];
-
-  for (auto &symbol : G13_KEY_STRINGS) {
-    _keys.emplace_back(G13_Key(*this, symbol, key_index));
-    key_index++;
-  }
-  assert(_keys.size() == G13_NUM_KEYS);
-
-  // now disable testing for keys in G13_NONPARSED_KEY_SEQ
-  for (auto &symbol : G13_NONPARSED_KEYS) {
-    G13_Key *key = FindKey(symbol);
-    key->_should_parse = false;
-  }
-}
-
 void G13_Profile::dump(std::ostream &o) const {
-  o << "Profile " << Helper::repr(name()) << std::endl;
-  for (auto &key : _keys) {
-    if (key.action()) {
+  o << "Profile " << Helper::repr(name());
+  if (_parent) {
+    o << " (inherits " << Helper::repr(_parent->name()) << ")";
+  }
+  o << std::endl;
+  for (size_t key = 0; key < G13_NUM_KEYS; key++) {
+    if (action(key)) {
       o << "   ";
-      key.dump(o);
+      dump_key(o, key);
       o << std::endl;
     }
   }
 }
 
-void G13_Profile::ParseKeys(unsigned char *buf) {
-  buf += 3;
-  for (auto &_key : _keys) {
-    if (_key._should_parse) {
-      _key.ParseKey(buf, &_keypad);
-    }
+G13_KEY_INDEX G13_Profile::FindKey(const std::string &keyname) {
+  auto key = G13_Manager::FindG13KeyValue(keyname);
+  if (key >= 0 && static_cast<size_t>(key) < G13_NUM_KEYS) {
+    return key;
   }
+  return -1;
 }
 
-G13_Key *G13_Profile::FindKey(const std::string &keyname) {
-  auto key = G13_Manager::Instance()->FindG13KeyValue(keyname);
-  if (key >= 0 && key < _keys.size()) {
-    return &_keys[key];
+G13_ActionPtr G13_Profile::action(G13_KEY_INDEX key) const {
+  for (auto profile = this; profile; profile = profile->_parent.get()) {
+    auto i = profile->_overrides.find(key);
+    if (i != profile->_overrides.end()) {
+      return i->second;
+    }
   }
   return nullptr;
 }
-} // namespace G13
\ No newline at end of file
+
+void G13_Profile::set_action(G13_KEY_INDEX key, G13_ActionPtr action) {
+  _overrides[key] = action;
+}
+
+G13_ActionPtr G13_Profile::own_action(G13_KEY_INDEX key) const {
+  auto i = _overrides.find(key);
+  return i == _overrides.end() ? nullptr : i->second;
+}
+
+/*! fills table with the bindings of this profile, parents first so that
+ * the overrides of each child win
+ */
+void G13_Profile::Flatten(G13_KeyTable &table) const {
+  if (_parent) {
+    _parent->Flatten(table);
+  } else {
+    table.Clear();
+  }
+  for (auto &binding : _overrides) {
+    table.set_action(binding.first, binding.second);
+  }
+}
+} // namespace G13
@@ -8,32 +8,47 @@
 #include "g13.hpp"
 #include "g13_action.hpp"
 #include "g13_device.hpp"
+#include <map>
+#include <memory>
 
 namespace G13 {
-class G13_Key;
 /*!
  * Represents a set of configured key mappings
  *
  * This allows a keypad to have multiple configured
  * profiles and switch between them easily
+ *
+ * A profile only stores the keys bound on it and inherits all others from
+ * its parent, so creating one is cheap and later changes to the parent show
+ * through. Flatten() resolves the chain into the key table used while the
+ * profile is active.
  */
 class G13_Profile {
 public:
-  G13_Profile(G13::G13_Device &keypad, std::string name_arg)
-      : _keypad(keypad), _name(std::move(name_arg)) {
-    _init_keys();
-  }
+  G13_Profile(G13::G13_Device &keypad, std::string name_arg,
+              std::shared_ptr<G13_Profile> parent = nullptr)
+      : _keypad(keypad), _name(std::move(name_arg)),
+        _parent(std::move(parent)) {}
+
+  // search key by G13 keyname, returns -1 if there is no such key
+  static G13_KEY_INDEX FindKey(const std::string &keyname);
+
+  // the action bound here or inherited from a parent
+  [[nodiscard]] G13_ActionPtr action(G13_KEY_INDEX key) const;
+
+  void set_action(G13_KEY_INDEX key, G13_ActionPtr action);
+
+  // the action bound on this profile itself, nullptr if key is inherited
+  [[nodiscard]] G13_ActionPtr own_action(G13_KEY_INDEX key) const;
 
-  G13_Profile(const G13_Profile &other, std::string name_arg)
-      : _keypad(other._keypad), _name(std::move(name_arg)), _keys(other._keys) {
-  }
+  // lets key be inherited from the parent again
+  void remove_action(G13_KEY_INDEX key) { _overrides.erase(key); }
 
-  // search key by G13 keyname
-  G13::G13_Key *FindKey(const std::string &keyname);
+  void Flatten(G13_KeyTable &table) const;
 
   void dump(std::ostream &o) const;
 
-  void ParseKeys(unsigned char *buf);
+  void dump_key(std::ostream &o, G13_KEY_INDEX key) const;
 
   [[nodiscard]] const std::string &name() const { return _name; }
 
@@ -41,10 +56,10 @@ public:
 
 protected:
   G13::G13_Device &_keypad;
-  std::vector<G13::G13_Key> _keys;
   std::string _name;
+  std::shared_ptr<G13_Profile> _parent;
 
-  void _init_keys();
+  std::map<G13_KEY_INDEX, G13_ActionPtr> _overrides;
 };
 } // namespace G13
 
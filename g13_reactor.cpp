@@ -0,0 +1,130 @@
+/* This file contains the event loop driving g13d
+ *
+ */
+
+#include "g13_reactor.hpp"
+#include "g13_log.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace G13 {
+
+G13_Reactor::G13_Reactor() : m_signal_fd(-1) {
+  m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+G13_Reactor::~G13_Reactor() {
+  if (m_signal_fd >= 0) {
+    close(m_signal_fd);
+  }
+  if (m_epoll_fd >= 0) {
+    close(m_epoll_fd);
+  }
+}
+
+bool G13_Reactor::Watch(int fd, uint32_t events, FD_HANDLER handler) {
+  struct epoll_event ev {};
+  ev.events = events;
+  ev.data.fd = fd;
+  int op = m_handlers.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(m_epoll_fd, op, fd, &ev) < 0) {
+    G13_ERR("Could not watch fd " << fd << ": " << strerror(errno));
+    return false;
+  }
+  m_handlers[fd] = std::move(handler);
+  return true;
+}
+
+void G13_Reactor::Unwatch(int fd) {
+  if (m_handlers.erase(fd)) {
+    // fails harmlessly if the fd has been closed already
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+int G13_Reactor::AddTimer(TIMER_HANDLER handler) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    G13_ERR("Could not create timer: " << strerror(errno));
+    return -1;
+  }
+  Watch(fd, EPOLLIN, [fd, handler](uint32_t) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) > 0) {
+      handler();
+    }
+  });
+  return fd;
+}
+
+void G13_Reactor::ArmTimer(int fd, long timeout_us, long interval_us) {
+  struct itimerspec its {};
+  its.it_value.tv_sec = timeout_us / 1000000;
+  its.it_value.tv_nsec = (timeout_us % 1000000) * 1000;
+  its.it_interval.tv_sec = interval_us / 1000000;
+  its.it_interval.tv_nsec = (interval_us % 1000000) * 1000;
+  if (timeout_us == 0 && interval_us == 0) {
+    // an all zero value would disarm the timer, fire as soon as possible
+    its.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(fd, 0, &its, nullptr);
+}
+
+void G13_Reactor::RemoveTimer(int fd) {
+  Unwatch(fd);
+  close(fd);
+}
+
+bool G13_Reactor::WatchSignals(std::initializer_list<int> signals,
+                               SIGNAL_HANDLER handler) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (auto signal : signals) {
+    sigaddset(&mask, signal);
+  }
+  m_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (m_signal_fd < 0) {
+    G13_ERR("Could not create signalfd: " << strerror(errno));
+    return false;
+  }
+  sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+  int fd = m_signal_fd;
+  return Watch(fd, EPOLLIN, [fd, handler](uint32_t) {
+    struct signalfd_siginfo info {};
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+      handler(static_cast<int>(info.ssi_signo));
+    }
+  });
+}
+
+int G13_Reactor::Poll(int timeout_ms) {
+  struct epoll_event events[16];
+  int count = epoll_wait(m_epoll_fd, events, 16, timeout_ms);
+  if (count < 0) {
+    if (errno != EINTR) {
+      G13_ERR("epoll_wait failed: " << strerror(errno));
+    }
+    return 0;
+  }
+
+  int handled = 0;
+  for (int i = 0; i < count; i++) {
+    // handlers may unwatch themselves or others, so look up each one late
+    // and call a copy
+    auto iter = m_handlers.find(events[i].data.fd);
+    if (iter != m_handlers.end()) {
+      FD_HANDLER handler = iter->second;
+      handler(events[i].events);
+      handled++;
+    }
+  }
+  return handled;
+}
+
+} // namespace G13
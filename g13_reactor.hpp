@@ -0,0 +1,54 @@
+/* This file contains the event loop driving g13d
+ *
+ */
+
+#ifndef G13_G13_REACTOR_HPP
+#define G13_G13_REACTOR_HPP
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+
+namespace G13 {
+
+/*!
+ * single epoll based event loop
+ *
+ * Everything g13d waits for is a file descriptor registered here: libusb's
+ * pollfds, the device pipes, a signalfd and timerfds. Poll() sleeps until one
+ * of them becomes ready and then runs its handler, so every wakeup has a cause
+ * and an idle daemon does not use any CPU.
+ */
+class G13_Reactor {
+public:
+  typedef std::function<void(uint32_t events)> FD_HANDLER;
+  typedef std::function<void()> TIMER_HANDLER;
+  typedef std::function<void(int signal)> SIGNAL_HANDLER;
+
+  G13_Reactor();
+  ~G13_Reactor();
+
+  bool Watch(int fd, uint32_t events, FD_HANDLER handler);
+  void Unwatch(int fd);
+
+  // returns the timerfd, which is also what RemoveTimer() and ArmTimer() take
+  int AddTimer(TIMER_HANDLER handler);
+  static void ArmTimer(int fd, long timeout_us, long interval_us = 0);
+  void RemoveTimer(int fd);
+
+  // blocks the signals and delivers them through a signalfd instead
+  bool WatchSignals(std::initializer_list<int> signals, SIGNAL_HANDLER handler);
+
+  // waits at most timeout_ms (-1 for ever), returns the number of handlers run
+  int Poll(int timeout_ms);
+
+protected:
+  int m_epoll_fd;
+  int m_signal_fd;
+  std::map<int, FD_HANDLER> m_handlers;
+};
+
+} // namespace G13
+
+#endif // G13_G13_REACTOR_HPP
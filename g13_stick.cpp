@@ -21,7 +21,7 @@ G13_Stick::G13_Stick(G13_Device &keypad)
                                   double x2, double y2) {
     m_zones.emplace_back(
         *this, "STICK_" + name, G13_ZoneBounds(x1, y1, x2, y2),
-        G13_ActionPtr(new G13_Action_Keys(keypad, "KEY_" + name)));
+        keypad.MakeAction("KEY_" + name, keypad.action_arena()));
   };
 
   add_zone("UP", 0.0, 0.1, 1.0, 0.3);
@@ -92,7 +92,7 @@ void G13_StickZone::dump(std::ostream &out) const {
   }
 }
 
-void G13_StickZone::test(const G13_ZoneCoord &loc) {
+void G13_StickZone::test(G13_Device &g13, const G13_ZoneCoord &loc) {
   if (!_action)
     return;
   bool prior_active = _active;
@@ -100,21 +100,35 @@ void G13_StickZone::test(const G13_ZoneCoord &loc) {
   if (!_active) {
     if (prior_active) {
       // cout << "exit stick zone " << m_name << std::endl;
-      _action->act(false);
+      _action->act(g13, false);
     }
   } else {
     // cout << "in stick zone " << m_name << std::endl;
-    _action->act(true);
+    _action->act(g13, true);
   }
 }
 
+void G13_StickZone::release(G13_Device &g13) {
+  if (_active && _action) {
+    _action->act(g13, false);
+  }
+  _active = false;
+}
+
 G13_StickZone::G13_StickZone(G13_Stick &stick, const std::string &name,
                              const G13_ZoneBounds &b,
-                             const G13_ActionPtr &action)
+                             G13_ActionPtr action)
     : G13_Actionable<G13_Stick>(stick, name), _bounds(b), _active(false) {
   set_action(action); // Call to virtual from ctor!
 }
 
+// releases every zone the stick is in, as if it had been let go of
+void G13_Stick::Release() {
+  for (auto &zone : m_zones) {
+    zone.release(_keypad);
+  }
+}
+
 void G13_Stick::ParseJoystick(const unsigned char *buf) {
   m_current_pos.x = buf[1];
   m_current_pos.y = buf[2];
@@ -169,7 +183,7 @@ void G13_Stick::ParseJoystick(const unsigned char *buf) {
   } else if (m_stick_mode == STICK_KEYS) {
     // BOOST_FOREACH (G13_StickZone& zone, m_zones) { zone.test(jpos); }
     for (auto &zone : m_zones) {
-      zone.test(jpos);
+      zone.test(_keypad, jpos);
     }
     return;
 
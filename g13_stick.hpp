@@ -36,14 +36,13 @@ public:
   void ParseJoystick(const unsigned char *buf);
 
   void set_mode(stick_mode_t);
+  void Release();
   G13_StickZone *zone(const std::string &, bool create = false);
   void RemoveZone(const G13_StickZone &zone);
 
-  /*
-    [[nodiscard]] const std::vector<G13_StickZone> &zones() const {
-      return m_zones;
-    }
-  */
+  [[nodiscard]] const std::vector<G13_StickZone> &zones() const {
+    return m_zones;
+  }
 
   void dump(std::ostream &) const;
 
@@ -0,0 +1,20 @@
+/* This file contains g13c, the bindfile compiler
+ *
+ */
+
+#include "GIT-VERSION.h"
+#include "g13_config_image.hpp"
+#include <iostream>
+
+using namespace G13;
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "g13c v" << GIT_VERSION << std::endl
+                  << "usage: g13c <bindfile> <image>" << std::endl
+                  << "compiles a bindfile into an image g13d --config loads"
+                  << std::endl;
+        return 1;
+    }
+    return G13_ConfigImage::Compile(argv[1], argv[2], std::cerr) ? 0 : 1;
+}
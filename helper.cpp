@@ -27,6 +27,8 @@
  */
 
 #include "helper.hpp"
+#include <algorithm>
+#include <unistd.h>
 
 // *************************************************************************
 
@@ -73,6 +75,87 @@ void string_repr_out::write_on(std::ostream &o) const {
   o << "\"";
 }
 
+// *************************************************************************
+
+LineBuffer::LineBuffer(size_t capacity)
+    : m_data(new char[capacity]), m_capacity(capacity), m_begin(0), m_end(0),
+      m_scanned(0) {}
+
+char *LineBuffer::WritePtr() {
+  if (m_begin == m_end) {
+    Clear();
+  } else if (m_begin > 0 && m_capacity - m_end < m_capacity / 4) {
+    // running out of space behind the partial line, move it to the front
+    memmove(m_data.get(), m_data.get() + m_begin, m_end - m_begin);
+    m_end -= m_begin;
+    m_scanned -= std::min(m_scanned, m_begin);
+    m_begin = 0;
+  }
+  return m_data.get() + m_end;
+}
+
+size_t LineBuffer::WriteSpace() {
+  WritePtr();
+  return m_capacity - m_end;
+}
+
+ssize_t LineBuffer::ReadFrom(int fd) {
+  if (WriteSpace() == 0) {
+    // a single line filled the whole buffer, nothing sensible to do but drop
+    // it
+    Clear();
+  }
+  ssize_t count = read(fd, WritePtr(), WriteSpace());
+  if (count > 0) {
+    Commit(count);
+  }
+  return count;
+}
+
+char *LineBuffer::NextLine() {
+  char *start = m_data.get() + m_begin;
+  size_t from = std::max(m_scanned, m_begin);
+  char *end = m_data.get() + m_end;
+  for (char *cp = m_data.get() + from; cp < end; cp++) {
+    if (*cp == '\n' || *cp == '\r') {
+      *cp = 0;
+      m_begin = cp + 1 - m_data.get();
+      m_scanned = m_begin;
+      return start;
+    }
+  }
+  m_scanned = m_end;
+  return nullptr;
+}
+
+// *************************************************************************
+
+void *Arena::Allocate(size_t size, size_t align) {
+  if (size == 0) {
+    // still a pointer of its own, and an empty arena has no chunk to point to
+    size = 1;
+  }
+  size_t offset = (m_used + align - 1) & ~(align - 1);
+  if (offset + size <= m_chunk_size) {
+    m_used = offset + size;
+    return m_chunks.back().get() + offset;
+  }
+  if (size > m_chunk_size / 4) {
+    // big requests get a chunk of their own, kept in front of the one that is
+    // being filled
+    auto pos = m_chunks.empty() ? m_chunks.end() : m_chunks.end() - 1;
+    return m_chunks.emplace(pos, new char[size])->get();
+  }
+  m_chunks.emplace_back(new char[m_chunk_size]);
+  m_used = size;
+  return m_chunks.back().get();
+}
+
+void Arena::Reset() {
+  m_chunks.clear();
+  m_used = m_chunk_size;
+}
+
 } // namespace Helper
 
 // *************************************************************************
@@ -31,9 +31,21 @@
 #ifndef __HELPER_HPP__
 #define __HELPER_HPP__
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
 #include <cstring>
 #include <iomanip>
+#include <limits>
 #include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <sys/types.h>
 
 // *************************************************************************
 
@@ -140,18 +152,110 @@ std::ostream &operator<<(std::ostream &o, const Bounds<T> &b) {
 
 typedef const char *CCP;
 
-inline const char *advance_ws(CCP &source, std::string &dest) {
-  const char *space = source ? strchr(source, ' ') : nullptr;
-  if (space) {
-    dest = std::string(source, space - source);
-    source = space + 1;
-  } else {
-    dest = source;
-    source = nullptr;
+// cuts line off at a # comment, along with the blanks before it
+inline void strip_comment(char *line) {
+  char *comment = strchr(line, '#');
+  if (comment) {
+    while (comment > line && isspace(comment[-1])) {
+      comment--;
+    }
+    *comment = 0;
   }
-  return source;
 }
 
+// the part of source up to delimiter, source is left behind the delimiter
+inline std::string_view split_off(std::string_view &source, char delimiter) {
+  auto end = source.find(delimiter);
+  auto token = source.substr(0, end);
+  source.remove_prefix(end == source.npos ? source.size() : end + 1);
+  return token;
+}
+
+/*! splits a NUL terminated line into words, copying nothing
+ *
+ * Words are separated by runs of blanks. rest() is what follows the last
+ * word taken, less the one blank that ended it, and is NUL terminated as it
+ * points into the line.
+ */
+class Tokenizer {
+public:
+  explicit Tokenizer(CCP line) : m_next(line) {}
+
+  // the next word, empty once there are none left
+  std::string_view next() {
+    while (*m_next == ' ' || *m_next == '\t') {
+      m_next++;
+    }
+    const char *begin = m_next;
+    while (*m_next && *m_next != ' ' && *m_next != '\t') {
+      m_next++;
+    }
+    std::string_view word(begin, m_next - begin);
+    if (*m_next) {
+      m_next++;
+    }
+    return word;
+  }
+
+  /*! the next word as a number, false if there is none or it is not a number
+   *
+   * Takes what sscanf() did: a sign, and for integers a 0x prefix for hex or
+   * a leading 0 for octal.
+   */
+  template <class T> bool next(T &value) {
+    auto word = next();
+    const char *begin = word.data();
+    const char *end = begin + word.size();
+    bool negative = begin != end && *begin == '-';
+    if (begin != end && (*begin == '-' || *begin == '+')) {
+      begin++;
+    }
+    if constexpr (std::is_integral_v<T>) {
+      int base = 10;
+      if (end - begin > 2 && begin[0] == '0' &&
+          (begin[1] == 'x' || begin[1] == 'X')) {
+        base = 16;
+        begin += 2;
+      } else if (end - begin > 1 && begin[0] == '0') {
+        base = 8;
+      }
+      unsigned long long magnitude = 0;
+      if (!Parsed(std::from_chars(begin, end, magnitude, base), begin, end)) {
+        return false;
+      }
+      auto limit =
+          static_cast<unsigned long long>(std::numeric_limits<T>::max());
+      if (negative && (!std::is_signed_v<T> || magnitude > limit + 1)) {
+        return false;
+      }
+      if (!negative && magnitude > limit) {
+        return false;
+      }
+      value = static_cast<T>(negative ? 0 - magnitude : magnitude);
+    } else {
+      if (!Parsed(std::from_chars(begin, end, value), begin, end)) {
+        return false;
+      }
+      if (negative) {
+        value = -value;
+      }
+    }
+    return true;
+  }
+
+  [[nodiscard]] CCP rest() const { return m_next; }
+
+protected:
+  // from_chars() took all of [begin, end), and it held a number without sign
+  static bool Parsed(std::from_chars_result result, const char *begin,
+                     const char *end) {
+    return begin != end && *begin != '-' && result.ec == std::errc() &&
+           result.ptr == end;
+  }
+
+  CCP m_next;
+};
+
 // *************************************************************************
 
 template <class MAP_T> struct _map_keys_out {
@@ -184,52 +288,197 @@ _map_keys_out<MAP_T> map_keys_out(const MAP_T &c,
 
 // *************************************************************************
 
-// This is from http://www.cplusplus.com/faq/sequences/strings/split
-// TODO: decltype
-
-struct split {
-  enum empties_t { empties_ok, no_empties };
+/*! reusable buffer for reading a line oriented stream
+ *
+ * Data is read straight into the free space behind what is already buffered
+ * and complete lines are handed out in place, NUL terminated where their
+ * line end was. A partial line stays buffered until the rest of it arrives.
+ * The space of consumed lines is reclaimed by moving the unparsed tail back
+ * to the front, which only ever copies the bytes of a partial line, and
+ * nothing is cleared.
+ */
+class LineBuffer {
+public:
+  explicit LineBuffer(size_t capacity = 64 * 1024);
+
+  // reads whatever fits from a non-blocking fd, returns the read() result
+  ssize_t ReadFrom(int fd);
+
+  // for callers filling the buffer themselves
+  char *WritePtr();
+  size_t WriteSpace();
+  void Commit(size_t count) { m_end += count; }
+
+  // next complete line, nullptr if there is none yet
+  char *NextLine();
+
+  // raw access to the unparsed bytes
+  [[nodiscard]] const char *data() const { return m_data.get() + m_begin; }
+  [[nodiscard]] size_t size() const { return m_end - m_begin; }
+  void Consume(size_t count) { m_begin += count; }
+  void Clear() { m_begin = m_end = m_scanned = 0; }
+
+protected:
+  std::unique_ptr<char[]> m_data;
+  size_t m_capacity;
+  size_t m_begin;
+  size_t m_end;
+  size_t m_scanned; // no line end before here, no need to look again
 };
 
-/*
-template <typename Container>
-auto split(Container& target,
-                 const typename Container::value_type& srcStr,
-                 const typename Container::value_type& delimiters,
-                 split::empties_t empties = split::empties_ok) {
-
-    Container result = split(srcStr,delimiters,empties);
-    std::swap(target,result);
-    return target;
+// *************************************************************************
+
+constexpr uint32_t string_hash(std::string_view str, uint32_t seed) {
+  // FNV-1a followed by murmur3's finalizer, so that the low bits are usable
+  uint32_t h = 2166136261u ^ (seed * 16777619u);
+  for (char c : str) {
+    h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
 }
-*/
-// template <typename T>
-// typename std::add_rvalue_reference<T>::type declval(); // no definition
-// required
-
-// decltype(*std::declval<T>()) operator*() { /* ... */ }
-template <typename Container>
-auto split(const typename Container::value_type &srcStr,
-           const typename Container::value_type &delimiters,
-           split::empties_t empties = split::empties_ok) {
-
-  Container result;
-  size_t current;
-  auto next = (size_t)-1;
-  do {
-    if (empties == split::no_empties) {
-      next = srcStr.find_first_not_of(delimiters, next + 1);
-      if (next == Container::value_type::npos)
-        break;
-      next -= 1;
-    }
-    current = next + 1;
-    next = srcStr.find_first_of(delimiters, current);
-    result.push_back(srcStr.substr(current, next - current));
-  } while (next != Container::value_type::npos);
-  return std::move(result);
+
+constexpr size_t next_pow2(size_t n) {
+  size_t p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
 }
 
+/*! perfect hash over N distinct strings, built at compile time
+ *
+ * Hash and displace: the first hash picks a bucket, each bucket has a seed
+ * chosen so that the second hash sends its keys to slots no other key uses.
+ * A lookup is two hashes, one compare and no probing. Build it as a
+ * constexpr object, duplicate keys then fail to compile.
+ */
+template <size_t N> class PerfectHash {
+public:
+  static constexpr size_t SLOTS = next_pow2(2 * N);
+  static constexpr size_t BUCKETS = SLOTS / 4;
+
+  constexpr explicit PerfectHash(const std::array<std::string_view, N> &keys)
+      : m_keys(keys), m_seeds(), m_slots() {
+    for (auto &slot : m_slots) {
+      slot = -1;
+    }
+    // sort the keys by bucket
+    std::array<size_t, BUCKETS + 1> starts{};
+    for (auto &key : m_keys) {
+      starts[Bucket(key) + 1]++;
+    }
+    size_t biggest = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+      biggest = std::max(biggest, starts[bucket + 1]);
+      starts[bucket + 1] += starts[bucket];
+    }
+    std::array<int, N> sorted{};
+    std::array<size_t, BUCKETS> filled{};
+    for (size_t i = 0; i < N; i++) {
+      size_t bucket = Bucket(m_keys[i]);
+      sorted[starts[bucket] + filled[bucket]++] = static_cast<int>(i);
+    }
+    // place the biggest buckets first, while there is most room
+    for (size_t size = biggest; size > 0; size--) {
+      for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        if (filled[bucket] == size) {
+          PlaceBucket(bucket, &sorted[starts[bucket]], size);
+        }
+      }
+    }
+  }
+
+  // index of key in the keys given, -1 if it is not one of them
+  [[nodiscard]] constexpr int find(std::string_view key) const {
+    int index = m_slots[Slot(key, m_seeds[Bucket(key)])];
+    return index >= 0 && m_keys[index] == key ? index : -1;
+  }
+
+protected:
+  static constexpr size_t Bucket(std::string_view key) {
+    return string_hash(key, 0) & (BUCKETS - 1);
+  }
+
+  static constexpr size_t Slot(std::string_view key, uint32_t seed) {
+    return string_hash(key, seed) & (SLOTS - 1);
+  }
+
+  constexpr void PlaceBucket(size_t bucket, const int *keys, size_t count) {
+    for (uint32_t seed = 1; seed < 1u << 20; seed++) {
+      size_t placed = 0;
+      while (placed < count) {
+        auto &slot = m_slots[Slot(m_keys[keys[placed]], seed)];
+        if (slot >= 0) {
+          break;
+        }
+        slot = keys[placed++];
+      }
+      if (placed == count) {
+        m_seeds[bucket] = seed;
+        return;
+      }
+      // undo the partial placement
+      while (placed > 0) {
+        m_slots[Slot(m_keys[keys[--placed]], seed)] = -1;
+      }
+    }
+    throw "no perfect hash found, are the keys distinct?";
+  }
+
+  std::array<std::string_view, N> m_keys;
+  std::array<uint32_t, BUCKETS> m_seeds;
+  std::array<int, SLOTS> m_slots;
+};
+
+// *************************************************************************
+
+/*! bump allocator for objects that all die together
+ *
+ * Memory comes from chunks that are never moved, so pointers handed out stay
+ * valid until Reset(), which drops everything at once. Nothing allocated here
+ * gets its destructor run, only trivially destructible types belong in it.
+ */
+class Arena {
+public:
+  explicit Arena(size_t chunk_size = 4096)
+      : m_chunk_size(chunk_size), m_used(chunk_size) {}
+
+  void *Allocate(size_t size, size_t align);
+
+  template <class T, class... ARGS> T *New(ARGS &&...args) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena objects are never destroyed");
+    return new (Allocate(sizeof(T), alignof(T)))
+        T{std::forward<ARGS>(args)...};
+  }
+
+  template <class T> T *Copy(const T *src, size_t count) {
+    auto dst = static_cast<T *>(Allocate(sizeof(T) * count, alignof(T)));
+    std::copy(src, src + count, dst);
+    return dst;
+  }
+
+  // a NUL terminated copy of str
+  const char *Copy(std::string_view str) {
+    auto dst = static_cast<char *>(Allocate(str.size() + 1, 1));
+    std::copy(str.begin(), str.end(), dst);
+    dst[str.size()] = 0;
+    return dst;
+  }
+
+  void Reset();
+
+protected:
+  std::vector<std::unique_ptr<char[]>> m_chunks;
+  size_t m_chunk_size;
+  size_t m_used; // in the last chunk
+};
+
 // *************************************************************************
 
 } // namespace Helper
@@ -6,8 +6,12 @@
 #include <iostream>
 
 // convert a .pbm raw file to our custom .lpbm format
+//
+// with --framed the image is wrapped in an image frame for g13d's input pipe
+// (header 00 'G' '1' '3', type 2, reserved 0, payload length 16 bit LE)
 
 int main(int argc, char* argv[]) {
+    bool framed = argc > 1 && !std::strcmp(argv[1], "--framed");
     unsigned char c;
     const int LEN = 256;
     char s[LEN];
@@ -52,6 +56,11 @@ int main(int argc, char* argv[]) {
         std::cerr << "wrong number of bytes, expected " << 160 * 43 / 8 << ", got " << i
                   << std::endl;
     }
+    if (framed) {
+        const int size = 160 * 48 / 8;
+        const char header[] = {0, 'G', '1', '3', 2, 0, (char)(size & 0xff), (char)(size >> 8)};
+        std::cout.write(header, sizeof(header));
+    }
     for (int i = 0; i < 160 * 48 / 8; i++) {
         std::cout << std::hex << (char)buf[i];
     }
@@ -13,8 +13,20 @@
 #include "g13.hpp"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "g13_config.hpp"
+#include "g13_config_image.hpp"
+#include "g13_device.hpp"
 #include "g13_manager.hpp"
 #include "g13_profile.hpp"
+#include "g13_log_appender.hpp"
+#include <log4cpp/BasicLayout.hh>
+#include <log4cpp/LoggingEvent.hh>
+#include <fstream>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 /*
 class MockManager : public G13::G13_Manager {
@@ -30,6 +42,61 @@ class MockDevice : public G13::G13_Device {
     MockDevice(G13::G13_Manager& manager) : G13_Device(nullptr, nullptr, nullptr, 0) {}
 };
 
+// feeds key reports and pipe input to a device without a handle
+class ReportingDevice : public G13::G13_Device {
+   public:
+    ReportingDevice() : G13_Device(nullptr, nullptr, nullptr, 0) {}
+    ~ReportingDevice() {
+        if (m_events >= 0) {
+            close(m_events);
+        }
+    }
+    // sends the events into a pipe read by KeyEvents(), in place of uinput
+    void RecordEvents() {
+        int fds[2];
+        ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+        m_events = fds[0];
+        m_uinput_fid = fds[1];
+    }
+    // code and value of the EV_KEY events sent since the last call
+    std::vector<std::pair<int, int>> KeyEvents() {
+        std::vector<std::pair<int, int>> keys;
+        struct input_event event {};
+        while (read(m_events, &event, sizeof(event)) == sizeof(event)) {
+            if (event.type == EV_KEY) {
+                keys.emplace_back(event.code, event.value);
+            }
+        }
+        return keys;
+    }
+    void Pipe(const void* data, size_t size) {
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        ASSERT_EQ(write(fds[1], data, size), static_cast<ssize_t>(size));
+        close(fds[1]);
+        m_input_pipe_fid = fds[0];
+        ReadCommandsFromPipe();
+        close(fds[0]);
+        m_input_pipe_fid = -1;
+    }
+    const unsigned char* pending_frame() const {
+        return m_lcd_frame_pending ? m_lcd_pending_frame : nullptr;
+    }
+    void Report(uint64_t keys) {
+        unsigned char report[G13::G13_REPORT_SIZE]{};
+        report[1] = report[2] = 0x80;  // stick centered
+        for (int i = 0; i < 5; i++) {
+            report[3 + i] = keys >> (8 * i) & 0xff;
+        }
+        ProcessKeyReport(report, {});
+    }
+    size_t bound_arenas() const { return m_bound_arenas.size(); }
+    size_t unbound_arenas() const { return m_unbound_arenas.size(); }
+
+   protected:
+    int m_events = -1;
+};
+
 class MockProfile : public G13::G13_Profile {
    public:
     MockProfile(G13::G13_Device& device) : G13_Profile(device, std::string("mock")) {}
@@ -57,6 +124,355 @@ TEST(G13Key, g13_key_maps_to_value) {
     // EXPECT_EQ(key->index(), 10);
 }
 
+TEST(LineBuffer, reassembles_split_lines) {
+    Helper::LineBuffer buffer(64);
+    auto feed = [&buffer](const char* text) {
+        memcpy(buffer.WritePtr(), text, strlen(text));
+        buffer.Commit(strlen(text));
+    };
+
+    feed("rgb 0 25");
+    EXPECT_EQ(buffer.NextLine(), nullptr);
+    feed("5 0\npos 1");
+    EXPECT_STREQ(buffer.NextLine(), "rgb 0 255 0");
+    EXPECT_EQ(buffer.NextLine(), nullptr);
+    feed(" 2\r\n");
+    EXPECT_STREQ(buffer.NextLine(), "pos 1 2");
+    EXPECT_STREQ(buffer.NextLine(), "");
+    EXPECT_EQ(buffer.size(), 0u);
+}
+
+TEST(Tokenizer, splits_words_and_numbers_in_place) {
+    const char* line = "rgb  10 x 0.5\tout  of here";
+    Helper::Tokenizer tokens(line);
+    int i = 0;
+    double d = 0;
+
+    EXPECT_EQ(tokens.next(), "rgb");
+    EXPECT_TRUE(tokens.next(i));
+    EXPECT_EQ(i, 10);
+    EXPECT_FALSE(tokens.next(i));
+    EXPECT_TRUE(tokens.next(d));
+    EXPECT_EQ(d, 0.5);
+    EXPECT_EQ(tokens.next(), "out");
+    EXPECT_STREQ(tokens.rest(), " of here");
+    EXPECT_EQ(tokens.next(), "of");
+    EXPECT_EQ(tokens.next(), "here");
+
+    // what sscanf("%i") and "%lf" took before
+    Helper::Tokenizer numbers("0xff 0X1A 010 -12 +3 -0x10 +0.25 0x 08 --1 99999999999");
+    EXPECT_TRUE(numbers.next(i));
+    EXPECT_EQ(i, 255);
+    EXPECT_TRUE(numbers.next(i));
+    EXPECT_EQ(i, 26);
+    EXPECT_TRUE(numbers.next(i));
+    EXPECT_EQ(i, 8);
+    EXPECT_TRUE(numbers.next(i));
+    EXPECT_EQ(i, -12);
+    EXPECT_TRUE(numbers.next(i));
+    EXPECT_EQ(i, 3);
+    EXPECT_TRUE(numbers.next(i));
+    EXPECT_EQ(i, -16);
+    EXPECT_TRUE(numbers.next(d));
+    EXPECT_EQ(d, 0.25);
+    EXPECT_FALSE(numbers.next(i));
+    EXPECT_FALSE(numbers.next(i));
+    EXPECT_FALSE(numbers.next(i));
+    EXPECT_FALSE(numbers.next(i));
+    EXPECT_EQ(tokens.next(), "");
+    EXPECT_FALSE(tokens.next(i));
+}
+
+TEST(Arena, allocates_zero_bytes_from_an_empty_arena) {
+    Helper::Arena arena(64);
+    auto first = arena.Allocate(0, 1);
+    EXPECT_NE(first, nullptr);
+    EXPECT_NE(arena.Allocate(0, 1), first);
+    EXPECT_STREQ(arena.Copy(std::string_view()), "");
+}
+
+TEST(G13Key, parsed_keys_mask_skips_nonparsed_keys) {
+    G13::G13_Manager* manager = G13::G13_Manager::Instance();
+
+    uint64_t nonparsed = 0;
+    for (auto& symbol : G13::G13_NONPARSED_KEYS) {
+        nonparsed |= uint64_t(1) << manager->FindG13KeyValue(symbol);
+    }
+    EXPECT_EQ(G13::G13_PARSED_KEYS_MASK, ((uint64_t(1) << G13::G13_NUM_KEYS) - 1) & ~nonparsed);
+}
+
+TEST(G13Key, input_names_cover_kernel_codes) {
+    G13::G13_Manager* manager = G13::G13_Manager::Instance();
+
+    EXPECT_EQ(manager->FindInputKeyValue("ESC"), KEY_ESC);
+    EXPECT_EQ(manager->FindInputKeyValue("KEY_MICMUTE"), KEY_MICMUTE);
+    EXPECT_EQ(manager->FindInputKeyValue("MFORWARD"), BTN_FORWARD);
+    EXPECT_EQ(manager->FindInputKeyValue("BTN_FORWARD"), BTN_FORWARD);
+    EXPECT_EQ(manager->FindInputKeyValue("SCREENLOCK"), KEY_COFFEE);
+    EXPECT_EQ(manager->FindInputKeyValue("REL_WHEEL"), G13::G13_REL_FLAG | REL_WHEEL);
+    EXPECT_EQ(manager->FindInputKeyValue("MOUSE"), G13::BAD_KEY_VALUE);
+    EXPECT_EQ(manager->FindInputKeyName(KEY_COFFEE), "COFFEE");
+    EXPECT_EQ(manager->FindInputKeyName(BTN_LEFT), "MLEFT");
+    EXPECT_EQ(manager->FindInputKeyName(G13::G13_REL_FLAG | G13::G13_REL_NEGATIVE | REL_WHEEL), "-REL_WHEEL");
+}
+
+TEST(AsyncAppender, writes_queued_records_on_close) {
+    char path[] = "/tmp/g13d-test-log-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+
+    G13::G13_AsyncAppender appender("test", fd);
+    appender.setLayout(new log4cpp::BasicLayout());
+    for (int i = 0; i < 100; i++) {
+        appender.doAppend(log4cpp::LoggingEvent("", "record " + std::to_string(i), "",
+                                                log4cpp::Priority::INFO));
+    }
+    std::string spilled = "long " + std::string(1000, 'x') + " end";
+    appender.doAppend(log4cpp::LoggingEvent("", spilled, "", log4cpp::Priority::INFO));
+    appender.close();
+
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    unlink(path);
+    EXPECT_NE(contents.str().find("record 0"), std::string::npos);
+    EXPECT_NE(contents.str().find("record 99"), std::string::npos);
+    EXPECT_NE(contents.str().find(spilled), std::string::npos);
+    EXPECT_EQ(appender.dropped(), 0u);
+}
+
+static void WriteTempFile(const char* contents, std::string* path) {
+    char name[] = "/tmp/g13d-test-bind-XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    *path = name;
+    size_t length = strlen(contents);
+    ASSERT_EQ(write(fd, contents, length), static_cast<ssize_t>(length));
+    ASSERT_EQ(close(fd), 0);
+}
+
+TEST(ConfigImage, maps_commands_parsed_by_g13c) {
+    std::string source;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("rgb 1 2 3 # comment\n"
+                                          "\n"
+                                          "bind G1 KEY_A+KEY_B\n"
+                                          "stickzone bounds STICK_UP 0 0.1 1 0.3\n",
+                                          &source));
+    auto target = source + ".g13c";
+    std::ostringstream errors;
+    ASSERT_TRUE(G13::G13_ConfigImage::Compile(source, target, errors)) << errors.str();
+    EXPECT_TRUE(G13::G13_ConfigImage::IsImage(target));
+    EXPECT_FALSE(G13::G13_ConfigImage::IsImage(source));
+
+    G13::G13_ConfigImage image;
+    ASSERT_TRUE(image.Open(target));
+    ASSERT_EQ(image.size(), 3u);
+    EXPECT_EQ(image.command(0).run, G13::G13_Device::FindCommand("rgb"));
+    EXPECT_EQ(image.command(0).args.i[2], 3);
+    EXPECT_EQ(image.line(1), 3u);
+    EXPECT_EQ(image.command(1).args.word, "G1");
+    EXPECT_STREQ(image.command(1).args.action, "KEY_A+KEY_B");
+    EXPECT_EQ(image.command(2).args.d[1], 0.1);
+    unlink(source.c_str());
+    unlink(target.c_str());
+}
+
+TEST(ConfigImage, reports_errors_by_line) {
+    std::string source;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("bind G1 KEY_NOPE\nrgb 1 x\nfrobnicate\n", &source));
+    auto target = source + ".g13c";
+    std::ostringstream errors;
+    EXPECT_FALSE(G13::G13_ConfigImage::Compile(source, target, errors));
+    EXPECT_NE(errors.str().find(source + ":1: "), std::string::npos);
+    EXPECT_NE(errors.str().find(source + ":2: "), std::string::npos);
+    EXPECT_NE(errors.str().find(source + ":3: unknown command"), std::string::npos);
+    EXPECT_NE(access(target.c_str(), F_OK), 0);
+    unlink(source.c_str());
+}
+
+TEST(Config, loads_once_and_notices_changes) {
+    std::string source;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("bind G1 KEY_A+KEY_B\n"
+                                          "bind G2 KEY_NOPE\n"
+                                          "rgb 1 2 3\n", &source));
+    auto config = G13::G13_Config::Load(source);
+    ASSERT_TRUE(config);
+    // the line with the unknown key is left out
+    ASSERT_EQ(config->commands().size(), 2u);
+    EXPECT_NE(config->commands()[0].args.made, nullptr);
+    EXPECT_EQ(config->commands()[1].args.made, nullptr);
+    EXPECT_FALSE(config->Stale());
+
+    std::ofstream(source, std::ios::app) << "rgb 4 5 6\n";
+    EXPECT_TRUE(config->Stale());
+    unlink(source.c_str());
+    EXPECT_TRUE(config->Stale());
+    EXPECT_FALSE(G13::G13_Config::Load(source));
+}
+
+TEST(Config, reload_changes_only_what_differs) {
+    std::string included;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("bind G2 KEY_B\n", &included));
+    std::string source;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("", &source));
+    auto include = "include " + included.substr(included.rfind('/') + 1) + "\n";
+    std::ofstream(source) << "bind G1 KEY_A\n" << include << "bind G4 KEY_E\n";
+    auto old_config = G13::G13_Config::Load(source);
+    ASSERT_TRUE(old_config);
+    EXPECT_EQ(old_config->files().size(), 2u);
+
+    G13::G13_Device g13(nullptr, nullptr, nullptr, 0);
+    g13.ApplyConfig(old_config);
+    ASSERT_TRUE(g13.Command("bind G3 KEY_C"));
+    auto profile = g13.Profile("default");
+    auto g1 = G13::G13_Profile::FindKey("G1"), g2 = G13::G13_Profile::FindKey("G2"),
+         g3 = G13::G13_Profile::FindKey("G3"), g4 = G13::G13_Profile::FindKey("G4");
+    auto runtime = profile->own_action(g3);
+
+    std::ofstream(source) << "bind G1 KEY_X\n" << include << "bind G3 KEY_D\nrgb 1 2 3\n";
+    ASSERT_TRUE(old_config->Stale());
+    auto new_config = G13::G13_Config::Load(source);
+    ASSERT_TRUE(new_config);
+    g13.ReloadConfig(old_config, new_config);
+
+    EXPECT_EQ(profile->own_action(g1), new_config->commands()[0].args.made);
+    // unchanged, but moved over so that the old configuration can go
+    EXPECT_EQ(profile->own_action(g2), new_config->commands()[1].args.made);
+    EXPECT_EQ(profile->own_action(g3), runtime);
+    EXPECT_EQ(profile->own_action(g4), nullptr);
+    EXPECT_EQ(old_config.use_count(), 1);
+
+    std::ofstream(included, std::ios::app) << "bind G5 KEY_F\n";
+    EXPECT_TRUE(new_config->Stale());
+    unlink(source.c_str());
+    unlink(included.c_str());
+}
+
+TEST(Config, profiles_are_made_when_first_selected) {
+    std::string source;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("bind G1 KEY_A\n"
+                                          "profile one\nbind G1 KEY_B\n"
+                                          "profile two\nbind G2 KEY_C\n"
+                                          "profile default\n", &source));
+    auto config = G13::G13_Config::Load(source);
+    ASSERT_TRUE(config);
+    ASSERT_TRUE(config->profile("two"));
+    EXPECT_EQ(config->profile("two")->parent, "one");
+    EXPECT_FALSE(config->profile("default"));
+
+    G13::G13_Device g13(nullptr, nullptr, nullptr, 0);
+    g13.ApplyConfig(config);
+    std::ostringstream dump;
+    g13.Dump(dump);
+    EXPECT_NE(dump.str().find("profiles=1 evictable=0"), std::string::npos);
+
+    auto g1 = G13::G13_Profile::FindKey("G1");
+    g13.SwitchToProfile("two");
+    EXPECT_EQ(g13.Profile("two")->action(g1), config->commands()[2].args.made);
+    dump.str("");
+    g13.Dump(dump);
+    EXPECT_NE(dump.str().find("profiles=3 evictable=2"), std::string::npos);
+
+    // "one" was selected less recently, but it is the parent of "two"
+    G13::G13_Manager::setStringConfigValue("profile_cache", "1");
+    g13.SwitchToProfile("default");
+    dump.str("");
+    g13.Dump(dump);
+    EXPECT_NE(dump.str().find("profiles=2 evictable=1"), std::string::npos);
+    G13::G13_Manager::setStringConfigValue("profile_cache", "");
+    unlink(source.c_str());
+}
+
+TEST(G13Key, profile_switch_in_a_chord_acts_on_the_whole_report) {
+    std::string source;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("bind G2 KEY_B\n"
+                                          "profile one\n"
+                                          "bind G1 !profile default\n"
+                                          "bind G2 KEY_B\n", &source));
+    auto config = G13::G13_Config::Load(source);
+    ASSERT_TRUE(config);
+    ReportingDevice g13;
+    ASSERT_NO_FATAL_FAILURE(g13.RecordEvents());
+    g13.ApplyConfig(config);
+    auto g1 = G13::G13_Profile::FindKey("G1"), g2 = G13::G13_Profile::FindKey("G2");
+    // G2 is pressed through "one", though G1 leaves "default" selected
+    g13.Report(uint64_t(1) << g1 | uint64_t(1) << g2);
+    std::ostringstream dump;
+    g13.Dump(dump);
+    EXPECT_NE(dump.str().find("current_profile=default"), std::string::npos);
+    g13.Report(0);
+    std::vector<std::pair<int, int>> expected{{KEY_B, 1}, {KEY_B, 0}};
+    EXPECT_EQ(g13.KeyEvents(), expected);
+    unlink(source.c_str());
+}
+
+TEST(G13Key, actions_bound_at_runtime_are_freed_when_replaced) {
+    std::string source;
+    ASSERT_NO_FATAL_FAILURE(WriteTempFile("bind G1 !bind G2 KEY_B\n", &source));
+    auto config = G13::G13_Config::Load(source);
+    ASSERT_TRUE(config);
+    ReportingDevice g13;
+    g13.ApplyConfig(config);
+    auto profile = g13.Profile("default");
+    auto g1 = G13::G13_Profile::FindKey("G1"), g2 = G13::G13_Profile::FindKey("G2"),
+         g3 = G13::G13_Profile::FindKey("G3"), g4 = G13::G13_Profile::FindKey("G4");
+
+    // what G1 binds was made with the configuration, pressing it makes nothing
+    g13.Report(uint64_t(1) << g1);
+    g13.Report(0);
+    auto nested = config->commands()[0].args.made->command()->compiled.args.made;
+    EXPECT_EQ(profile->own_action(g2), nested);
+    EXPECT_EQ(g13.bound_arenas(), 0u);
+
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(g13.Command("bind G3 KEY_C"));
+    }
+    EXPECT_EQ(g13.bound_arenas(), 1u);
+    EXPECT_EQ(g13.unbound_arenas(), 2u);
+    g13.Report(0);
+    EXPECT_EQ(g13.unbound_arenas(), 0u);
+
+    // G4 keeps its action when the one that bound it is replaced
+    ASSERT_TRUE(g13.Command("bind G1 !bind G4 KEY_D"));
+    g13.Report(uint64_t(1) << g1);
+    g13.Report(0);
+    auto g4_action = profile->own_action(g4);
+    ASSERT_TRUE(g4_action);
+    EXPECT_EQ(g13.bound_arenas(), 2u);
+    ASSERT_TRUE(g13.Command("bind G1 KEY_A"));
+    ASSERT_TRUE(profile->own_action(g4));
+    EXPECT_NE(profile->own_action(g4), g4_action);
+    EXPECT_EQ(g13.bound_arenas(), 3u);
+    g13.Report(0);
+    EXPECT_EQ(g13.unbound_arenas(), 0u);
+    ASSERT_TRUE(profile->own_action(g4)->keys());
+
+    // and so does G2 when the configuration that bound it is reloaded
+    std::ofstream(source) << "bind G1 KEY_A\n";
+    auto new_config = G13::G13_Config::Load(source);
+    ASSERT_TRUE(new_config);
+    g13.ReloadConfig(config, new_config);
+    ASSERT_TRUE(profile->own_action(g2));
+    EXPECT_NE(profile->own_action(g2), nested);
+    EXPECT_EQ(config.use_count(), 1);
+    unlink(source.c_str());
+}
+
+TEST(Pipe, raw_images_may_start_with_a_zero_byte) {
+    ReportingDevice g13;
+    unsigned char image[G13::G13_LCD_BUFFER_SIZE] = {0, 0x3c, 0x42};
+    g13.Pipe(image, sizeof(image));
+    ASSERT_NE(g13.pending_frame(), nullptr);
+    EXPECT_EQ(memcmp(g13.pending_frame(), image, sizeof(image)), 0);
+
+    // a bad frame only takes its own line with it
+    const char input[] = "\0bad\nprofile two\n";
+    g13.Pipe(input, sizeof(input) - 1);
+    std::ostringstream dump;
+    g13.Dump(dump);
+    EXPECT_NE(dump.str().find("current_profile=two"), std::string::npos);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
 